@@ -23,28 +23,32 @@ int main()
 		// std::lock_guard won't work
 		std::unique_lock<std::mutex> lock(globalLock);
 
-		if (!ready)
-		{
-			// blocks thread until condition variable is woken up
-			// pass in the lock here to tell conditional variable which lock
-			// to unlock as you wait for the results to be ready since
-			// wait(std::mutex mut) atomically unlocked the mutex mut before
-			// being blocked and going to sleep
-			globalConditionVariable.wait(lock);
-		}
+		// blocks thread until condition variable is woken up
+		// pass in the lock here to tell conditional variable which lock
+		// to unlock as you wait for the results to be ready since
+		// wait(std::mutex mut) atomically unlocked the mutex mut before
+		// being blocked and going to sleep.
+		// Always wait on the predicate, not a one-off if (!ready): the
+		// predicate is checked under the lock before sleeping (so a notify
+		// that came before we got here isn't lost) and again after every
+		// wake up (so a spurious wake up doesn't read a half-done result)
+		globalConditionVariable.wait(lock, [&]() { return ready; });
 		std::cout << "Reporter sees result:" << result << std::endl;
 	});
 
 	// worker thread
 	std::thread worker([&]() {
-		std::lock_guard<std::mutex> lock(globalLock);
-
-		// artificially do work
-		result = 42;
-		ready = true;
+		// artificially do work, without holding the lock
 		std::this_thread::sleep_for(3s);
 
-		// notifies one other thread that is sleeping that mutex is free to access
+		{
+			std::lock_guard<std::mutex> lock(globalLock);
+			result = 42;
+			ready = true;
+		}
+
+		// notifies one other thread that is sleeping that the result is
+		// ready; fine to do after unlocking since ready was set under it
 		globalConditionVariable.notify_one();
 	});
 
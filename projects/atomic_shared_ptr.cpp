@@ -0,0 +1,133 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+
+/*
+ * Snapshot publishing: every reader loads the current "routing table" in a
+ * tight loop while one writer publishes a new one every WRITE_INTERVAL.
+ * A table keeps first + second == 0, so a reader that sees it broken got a
+ * table that was freed or not fully built. Reports loads per second for
+ * std::atomic<std::shared_ptr> and AtomicSharedPtr.
+ *
+ * The writer cycles through NUM_TABLES tables built up front, so what's
+ * measured is the slot, not building and freeing tables.
+ */
+
+#define RUN_TIME std::chrono::milliseconds(200)
+#define WRITE_INTERVAL std::chrono::microseconds(100)
+#define NUM_TABLES 4
+#define CAS_ROUNDS 100000
+
+struct Table
+{
+    long long first;
+    long long second;
+};
+
+template<typename Ptr, typename Load, typename Store>
+void readMostly(const char* name, int numReaders, const std::vector<Ptr>& tables, Load load, Store store)
+{
+    std::atomic<bool> stop = false;
+    std::atomic<long long> loads = 0;
+    std::atomic<bool> torn = false;
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < numReaders; t++)
+    {
+        readers.emplace_back([&]()
+        {
+            long long n = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                Ptr table = load();
+                if (table->first + table->second != 0) torn = true;
+                n++;
+            }
+            loads += n;
+        });
+    }
+
+    std::thread writer([&]()
+    {
+        for (size_t i = 1; !stop.load(); i++)
+        {
+            store(tables[i % tables.size()]);
+            std::this_thread::sleep_for(WRITE_INTERVAL);
+        }
+    });
+
+    std::this_thread::sleep_for(RUN_TIME);
+    stop = true;
+    writer.join();
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+
+    double seconds = std::chrono::duration<double>(RUN_TIME).count();
+    std::cout << std::boolalpha << name << " READERS:" << numReaders
+              << " LOADS/S:" << size_t(loads / seconds)
+              << " CONSISTENT:" << !torn << std::endl;
+}
+
+int main()
+{
+    std::vector<std::shared_ptr<Table>> stdTables;
+    std::vector<MySharedPtr<Table>> myTables;
+    for (long long i = 0; i < NUM_TABLES; i++)
+    {
+        stdTables.push_back(std::make_shared<Table>(Table{ i, -i }));
+        myTables.push_back(MySharedPtr<Table>(Table{ i, -i }));
+    }
+
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        std::atomic<std::shared_ptr<Table>> stdSlot(stdTables[0]);
+        readMostly("STD_ATOMIC_SHARED_PTR", n, stdTables,
+            [&]() { return stdSlot.load(); },
+            [&](const std::shared_ptr<Table>& table) { stdSlot.store(table); });
+
+        AtomicSharedPtr<Table> mySlot(myTables[0]);
+        readMostly("ATOMIC_SHARED_PTR    ", n, myTables,
+            [&]() { return mySlot.load(); },
+            [&](const MySharedPtr<Table>& table) { mySlot.store(table); });
+    }
+
+    // compare_exchange only replaces what it was told to expect
+    AtomicSharedPtr<Table> slot(myTables[0]);
+    MySharedPtr<Table> expected = myTables[1];
+    bool swappedStale = slot.compare_exchange_strong(expected, myTables[2]);
+    bool swappedCurrent = slot.compare_exchange_strong(expected, myTables[2]);
+    std::cout << std::boolalpha << "CAS STALE:" << swappedStale << " CAS CURRENT:" << swappedCurrent
+              << " " << (slot.load().get() == myTables[2].get()) << " LOCK FREE:" << slot.is_lock_free() << std::endl;
+
+    // the same table stored over and over gets a new holder each time, a
+    // compare_exchange expecting it must still never fail
+    std::atomic<bool> stop = false;
+    std::thread restorer([&]()
+    {
+        while (!stop.load()) slot.store(myTables[2]);
+    });
+    bool alwaysSwapped = true;
+    for (int i = 0; i < CAS_ROUNDS; i++)
+    {
+        expected = myTables[2];
+        alwaysSwapped &= slot.compare_exchange_strong(expected, myTables[2]);
+    }
+    stop = true;
+    restorer.join();
+    std::cout << "CAS SAME TABLE RESTORED:" << alwaysSwapped << std::endl;
+
+    // empty for empty, the slot stays usable
+    AtomicSharedPtr<Table> empty;
+    MySharedPtr<Table> none(nullptr);
+    bool swappedEmpty = empty.compare_exchange_strong(none, MySharedPtr<Table>(nullptr));
+    empty.store(myTables[3]);
+    std::cout << "CAS EMPTY:" << swappedEmpty << " " << (empty.load().get() == myTables[3].get()) << std::endl;
+}
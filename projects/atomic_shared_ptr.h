@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "my_shared_ptr.h"
+
+/*
+ * Atomic MySharedPtr slot for publishing immutable snapshots (configs,
+ * routing tables): any number of readers load() it while writers store()
+ * new versions, and neither side ever takes a lock.
+ *
+ * Split reference count, as in "C++ Concurrency in Action" 7.2.4. The slot
+ * holds a pointer to a Holder (which owns one reference to the object)
+ * with a 16 bit count of in-flight loads packed into the unused top bits.
+ * load() bumps that count with one fetch_add, which keeps the Holder alive
+ * while it copies the MySharedPtr out, then takes its increment back out
+ * again. When a writer swaps the Holder out it moves the loads still in
+ * flight over to the Holder's own count, and the last of them deletes it.
+ *
+ * Relies on user space pointers fitting in 48 bits (x86-64, AArch64) and
+ * on no more than 65535 loads of one slot being in flight at once.
+ */
+template<typename T, typename RefCount = AtomicRefCount>
+class AtomicSharedPtr
+{
+    static_assert(std::is_same_v<RefCount, AtomicRefCount>, "AtomicSharedPtr needs thread safe reference counts");
+
+public:
+    using Ptr = MySharedPtr<T, RefCount>;
+
+    AtomicSharedPtr()
+    : word_(0)
+    {
+    }
+
+    explicit AtomicSharedPtr(Ptr ptr)
+    : word_(pack(wrap(std::move(ptr)), 0))
+    {
+    }
+
+    AtomicSharedPtr(AtomicSharedPtr&) = delete;
+    AtomicSharedPtr(AtomicSharedPtr&&) = delete;
+
+    ~AtomicSharedPtr()
+    {
+        // nobody can be loading any more
+        delete holderOf(word_.load(std::memory_order_acquire));
+    }
+
+    Ptr load() const
+    {
+        if (word_.load(std::memory_order_relaxed) == 0) return nullptr;
+
+        Holder* holder = acquire();
+        Ptr out = holder ? holder->ptr : Ptr(nullptr);
+        drop(holder);
+        return out;
+    }
+
+    void store(Ptr ptr)
+    {
+        exchange(std::move(ptr));
+    }
+
+    Ptr exchange(Ptr ptr)
+    {
+        uintptr_t old = word_.exchange(pack(wrap(std::move(ptr)), 0), std::memory_order_acq_rel);
+        Holder* holder = holderOf(old);
+        if (!holder) return nullptr;
+
+        Ptr out = holder->ptr;
+        retire(holder, countOf(old));
+        return out;
+    }
+
+    // stores desired if the slot still holds expected (same object, same
+    // owner), otherwise loads what it does hold into expected
+    bool compare_exchange_strong(Ptr& expected, Ptr desired)
+    {
+        Holder* next = nullptr;
+        for (;;)
+        {
+            Holder* holder = acquire();
+            if (!holder ? expected.get() != nullptr : !sameAs(holder->ptr, expected))
+            {
+                expected = holder ? holder->ptr : Ptr(nullptr);
+                drop(holder);
+                delete next;
+                return false;
+            }
+
+            // wrapped on the first match only, desired is empty after that
+            if (desired) next = wrap(std::move(desired));
+            uintptr_t current = word_.load(std::memory_order_relaxed);
+            while (holderOf(current) == holder)
+            {
+                // our own in-flight count goes over with the others and comes
+                // back out through drop(), like any load that lost the slot
+                if (word_.compare_exchange_weak(current, pack(next, 0), std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    if (holder) retire(holder, countOf(current));
+                    drop(holder);
+                    return true;
+                }
+            }
+
+            // the CAS goes by holder, but a new holder may hold the same
+            // object (someone stored it again): compare that one instead
+            drop(holder);
+        }
+    }
+
+    bool is_lock_free() const { return word_.is_lock_free(); }
+
+private:
+    struct Holder
+    {
+        explicit Holder(Ptr p)
+        : ptr(std::move(p))
+        , loads(0)
+        {
+        }
+
+        Ptr ptr;
+        // in-flight loads handed over by retire() minus those that finished
+        std::atomic<int64_t> loads;
+    };
+
+    static constexpr int COUNT_SHIFT = 48;
+    static constexpr uintptr_t COUNT_ONE = uintptr_t(1) << COUNT_SHIFT;
+    static constexpr uintptr_t POINTER_MASK = COUNT_ONE - 1;
+
+    static uintptr_t pack(Holder* holder, uintptr_t count) { return reinterpret_cast<uintptr_t>(holder) | (count << COUNT_SHIFT); }
+    static Holder* holderOf(uintptr_t word) { return reinterpret_cast<Holder*>(word & POINTER_MASK); }
+    static int64_t countOf(uintptr_t word) { return int64_t(word >> COUNT_SHIFT); }
+
+    static Holder* wrap(Ptr ptr) { return ptr ? new Holder(std::move(ptr)) : nullptr; }
+
+    static bool sameAs(const Ptr& a, const Ptr& b) { return a.get() == b.get() && a.block_ == b.block_; }
+
+    // the Holder in the slot right now, safe to read until drop()
+    Holder* acquire() const
+    {
+        return holderOf(word_.fetch_add(COUNT_ONE, std::memory_order_acquire));
+    }
+
+    void drop(Holder* holder) const
+    {
+        // an empty slot's count protects nothing, and a store may already
+        // have wiped our increment along with it: never go below zero
+        uintptr_t current = word_.load(std::memory_order_relaxed);
+        while (holderOf(current) == holder && (holder || countOf(current) > 0))
+        {
+            if (word_.compare_exchange_weak(current, current - COUNT_ONE, std::memory_order_release, std::memory_order_relaxed)) return;
+        }
+
+        // swapped out since, our increment went over to holder->loads
+        if (holder && holder->loads.fetch_sub(1, std::memory_order_acq_rel) == 1) delete holder;
+    }
+
+    // holder just left the slot with inFlight loads still counted on it
+    static void retire(Holder* holder, int64_t inFlight)
+    {
+        if (holder->loads.fetch_add(inFlight, std::memory_order_acq_rel) + inFlight == 0) delete holder;
+    }
+
+    mutable std::atomic<uintptr_t> word_;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * Which cpus belong to which NUMA node, read from /sys/devices/system/node.
+ * Only cpus this process may run on (taskset, cgroups) are listed. Without
+ * the sysfs tree (other OSes, some containers) everything is one node.
+ */
+struct CpuTopology
+{
+    std::vector<std::vector<int>> nodes; // cpus of each node, never empty
+
+    size_t numNodes() const { return nodes.size(); }
+
+    size_t numCpus() const
+    {
+        size_t n = 0;
+        for (const std::vector<int>& cpus : nodes) n += cpus.size();
+        return n;
+    }
+
+    static CpuTopology detect()
+    {
+        std::vector<int> allowed = allowedCpus();
+        CpuTopology topology;
+
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::vector<std::pair<int, fs::path>> nodeDirs;
+        for (const fs::directory_entry& entry : fs::directory_iterator("/sys/devices/system/node", ec))
+        {
+            std::string name = entry.path().filename().string();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0
+                && std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            {
+                nodeDirs.emplace_back(std::stoi(name.substr(4)), entry.path());
+            }
+        }
+        std::sort(nodeDirs.begin(), nodeDirs.end());
+
+        for (auto& [id, dir] : nodeDirs)
+        {
+            std::ifstream in(dir / "cpulist");
+            std::string list;
+            std::getline(in, list);
+
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(list))
+            {
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) cpus.push_back(cpu);
+            }
+            // memory-only nodes, or nodes we aren't allowed on
+            if (!cpus.empty()) topology.nodes.push_back(std::move(cpus));
+        }
+
+        if (topology.nodes.empty()) topology.nodes.push_back(std::move(allowed));
+        return topology;
+    }
+
+    // "0-3,8,10-11" -> 0 1 2 3 8 10 11
+    static std::vector<int> parseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ','))
+        {
+            if (range.empty()) continue;
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+private:
+    static std::vector<int> allowedCpus()
+    {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+            }
+        }
+#endif
+        if (cpus.empty())
+        {
+            for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) cpus.push_back(int(cpu));
+        }
+        return cpus;
+    }
+};
+
+// restricts the calling thread to cpus, false if that isn't supported here
+inline bool pinCurrentThread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// same for a single cpu, without building a vector for it
+inline bool pinCurrentThread(int cpu)
+{
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// the cpu's cycle counter where there is a cheap one, converted to ns using
+// a ratio measured once against steady_clock
+class CycleClock
+{
+public:
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    static uint64_t toNanos(uint64_t ticks) { return uint64_t(double(ticks) * nanosPerTick()); }
+
+    static double nanosPerTick()
+    {
+        static const double ratio = calibrate();
+        return ratio;
+    }
+
+private:
+    static double calibrate()
+    {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+        uint64_t startTicks = now();
+        while (Clock::now() - start < std::chrono::milliseconds(2)) {}
+        uint64_t ticks = now() - startTicks;
+        std::chrono::nanoseconds elapsed = Clock::now() - start;
+        return ticks ? double(elapsed.count()) / double(ticks) : 1.0;
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "futex.h"
+
+/*
+ * Eventcount: a condition variable for lock-free code. Waiting for some
+ * condition (queue not empty, ...) goes
+ *
+ *   for (;;)
+ *   {
+ *       if (tryPop(item)) break;
+ *       EventCount::Key key = ec.prepareWait();
+ *       if (tryPop(item))
+ *       {
+ *           ec.cancelWait();
+ *           break;
+ *       }
+ *       ec.commitWait(key);
+ *   }
+ *
+ * and whoever makes the condition true calls notify() afterwards. A notify
+ * after prepareWait() makes commitWait() return right away, so there is no
+ * window in which the wake-up gets lost, and no mutex around the condition.
+ *
+ * notify() is a fence and a load when nobody is waiting: producers only
+ * enter the kernel if a waiter has actually registered, unlike
+ * condition_variable::notify_one(), which is a syscall every time.
+ *
+ * Waiters are counted in waiters_, the futex word is the separate epoch_
+ * that every notify with waiters bumps.
+ */
+class EventCount
+{
+public:
+    // the epoch a waiter saw when it registered
+    class Key
+    {
+    public:
+        explicit Key(uint32_t epoch)
+        : epoch_(epoch)
+        {
+        }
+
+    private:
+        friend class EventCount;
+        uint32_t epoch_;
+    };
+
+    EventCount() = default;
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    // wakes one waiter, if there are any
+    void notify()
+    {
+        if (bump()) futexWake(epoch_);
+    }
+
+    void notifyAll()
+    {
+        if (bump()) futexWakeAll(epoch_);
+    }
+
+    // registers as a waiter; recheck the condition after this, then
+    // cancelWait() or commitWait()
+    Key prepareWait()
+    {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        return Key(epoch_.load(std::memory_order_acquire));
+    }
+
+    // the condition turned out true after all
+    void cancelWait()
+    {
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // sleeps until a notify after prepareWait()
+    void commitWait(Key key)
+    {
+        while (epoch_.load(std::memory_order_acquire) == key.epoch_)
+        {
+            futexWait(epoch_, key.epoch_);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // same, false if timeout passed without a notify
+    bool commitWaitFor(Key key, std::chrono::nanoseconds timeout)
+    {
+        auto until = std::chrono::steady_clock::now() + timeout;
+        bool notified = true;
+        while (epoch_.load(std::memory_order_acquire) == key.epoch_)
+        {
+            auto left = until - std::chrono::steady_clock::now();
+            if (left <= std::chrono::nanoseconds::zero())
+            {
+                notified = false;
+                break;
+            }
+            futexWaitFor(epoch_, key.epoch_, left);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return notified;
+    }
+
+private:
+    // new epoch if someone is (about to be) waiting, false otherwise
+    bool bump()
+    {
+        // pairs with the seq_cst increment in prepareWait(): either we see
+        // the waiter, or its recheck sees our change
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) == 0) return false;
+        epoch_.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    std::atomic<uint32_t> epoch_{ 0 };
+    std::atomic<uint32_t> waiters_{ 0 };
+};
@@ -0,0 +1,139 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "fiber.h"
+
+/*
+ * atomic.cpp's pattern, one short-lived thread per increment, with
+ * std::thread against fibers, then the things only fibers do: yielding,
+ * and fibers joining fibers they spawned.
+ */
+
+#define NUM_THREADS 5000
+#define NUM_FIBERS 50000
+#define NUM_YIELDS 1000
+#define FAN_OUT 100
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic_int glob = 0;
+
+void foo()
+{
+    glob++;
+}
+
+double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main()
+{
+    FiberScheduler scheduler;
+
+    // one std::thread per increment, as in atomic.cpp
+    glob = 0;
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        threads.emplace_back(&foo);
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    double threadMs = msSince(start);
+    std::cout << std::boolalpha << "THREADS GLOB:" << glob << " " << (glob == NUM_THREADS)
+              << " US/SPAWN:" << threadMs * 1000 / NUM_THREADS << std::endl;
+
+    // same with ten times as many fibers
+    glob = 0;
+    start = Clock::now();
+    std::vector<Fiber> fibers;
+    for (int i = 0; i < NUM_FIBERS; i++)
+    {
+        fibers.push_back(scheduler.spawn(&foo));
+    }
+    for (Fiber& fiber : fibers)
+    {
+        fiber.join();
+    }
+    double fiberMs = msSince(start);
+    std::cout << "FIBERS GLOB:" << glob << " " << (glob == NUM_FIBERS)
+              << " US/SPAWN:" << fiberMs * 1000 / NUM_FIBERS << std::endl;
+
+    // two fibers taking turns on one counter, each only moves on when it
+    // sees the other's increment, so this needs yield() to make progress
+    // even on a single worker
+    FiberScheduler single(1);
+    std::atomic_int turn = 0;
+    auto player = [&turn](int me)
+    {
+        for (int i = 0; i < NUM_YIELDS; i++)
+        {
+            while (turn.load() % 2 != me) FiberScheduler::yield();
+            turn++;
+        }
+    };
+    start = Clock::now();
+    Fiber even = single.spawn(player, 0);
+    Fiber odd = single.spawn(player, 1);
+    even.join();
+    odd.join();
+    std::cout << "PING PONG TURNS:" << turn << " " << (turn == 2 * NUM_YIELDS)
+              << " US/TURN:" << msSince(start) * 1000 / (2 * NUM_YIELDS) << std::endl;
+
+    // fibers spawning and joining fibers: the parents park, the workers
+    // keep running the children
+    glob = 0;
+    std::vector<Fiber> parents;
+    for (int i = 0; i < FAN_OUT; i++)
+    {
+        parents.push_back(scheduler.spawn([&scheduler]()
+        {
+            std::vector<Fiber> children;
+            for (int j = 0; j < FAN_OUT; j++)
+            {
+                children.push_back(scheduler.spawn(&foo));
+            }
+            for (Fiber& child : children)
+            {
+                child.join();
+            }
+        }));
+    }
+    for (Fiber& parent : parents)
+    {
+        parent.join();
+    }
+    std::cout << "NESTED GLOB:" << glob << " " << (glob == FAN_OUT * FAN_OUT) << std::endl;
+
+    // detached ones are waited for by the scheduler's destructor
+    glob = 0;
+    {
+        FiberScheduler detached(2);
+        for (int i = 0; i < FAN_OUT; i++)
+        {
+            detached.spawn(&foo).detach();
+        }
+    }
+    std::cout << "DETACHED GLOB:" << glob << " " << (glob == FAN_OUT) << std::endl;
+
+    bool threw = false;
+    try
+    {
+        Fiber fiber = spawn(&foo);
+        fiber.join();
+        fiber.join();
+    }
+    catch (std::logic_error&)
+    {
+        threw = true;
+    }
+    std::cout << "JOIN TWICE THROWS:" << threw << std::endl;
+}
@@ -0,0 +1,622 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#include "futex.h"
+#include "inline_task.h"
+#include "my_mutex.h"
+#include "my_shared_ptr.h"
+
+/*
+ * Stackful fibers (green threads): many logical threads multiplexed over a
+ * fixed set of kernel threads, switched in user mode.
+ *
+ *   FiberScheduler scheduler(4);
+ *   Fiber f = scheduler.spawn(foo, std::ref(x), 42);
+ *   f.join();
+ *
+ * or spawn(foo, ...) on the process-wide defaultScheduler(). Fiber works like
+ * std::thread: join() or detach() it before it goes away, arguments are
+ * copied (std::ref to pass references).
+ *
+ * Every fiber has its own mmap'ed stack (STACK_SIZE, with a guard page below
+ * it so an overflow faults instead of scribbling over a neighbour), reused
+ * through a small cache. A switch saves and restores only the callee-saved
+ * registers, a few ns; that and a queue push is what spawn() costs, against
+ * a clone() and tens of KB of kernel state for a std::thread.
+ *
+ * Scheduling is cooperative: a fiber runs until it returns, yields
+ * (FiberScheduler::yield()) or joins another fiber. Anything that blocks the
+ * kernel thread (Mutex::lock under contention, sleep_for, blocking I/O)
+ * blocks every fiber queued behind it on that worker, so keep fiber bodies
+ * short or non-blocking. An exception escaping a fiber calls
+ * std::terminate(), as it would for a std::thread.
+ *
+ * The context switch is hand-written for x86-64 (SysV); elsewhere it falls
+ * back to ucontext, which also swaps the signal mask and so costs a syscall
+ * per switch. Under ThreadSanitizer every fiber is announced with the
+ * __tsan_*_fiber hooks so it doesn't mistake the switches for races.
+ */
+
+#if defined(__SANITIZE_THREAD__)
+#define FIBER_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define FIBER_TSAN 1
+#endif
+#endif
+
+#ifdef FIBER_TSAN
+extern "C"
+{
+void* __tsan_get_current_fiber();
+void* __tsan_create_fiber(unsigned flags);
+void __tsan_destroy_fiber(void* fiber);
+void __tsan_switch_to_fiber(void* fiber, unsigned flags);
+}
+#endif
+
+#if defined(__x86_64__)
+
+extern "C" void fiber_switch_context(void** saveSp, void* loadSp);
+extern "C" void fiber_entry_trampoline();
+
+// weak, so every translation unit including this header can emit them
+asm(R"(
+    .pushsection .text
+    .weak fiber_switch_context
+    .type fiber_switch_context, @function
+fiber_switch_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $16, %rsp
+    fnstcw (%rsp)
+    stmxcsr 8(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    fldcw (%rsp)
+    ldmxcsr 8(%rsp)
+    addq $16, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size fiber_switch_context, .-fiber_switch_context
+
+    .weak fiber_entry_trampoline
+    .type fiber_entry_trampoline, @function
+fiber_entry_trampoline:
+    movq %r12, %rdi
+    callq *%r13
+    ud2
+    .size fiber_entry_trampoline, .-fiber_entry_trampoline
+    .popsection
+)");
+
+// saved stack pointer, the registers are on the stack below it
+class FiberContext
+{
+public:
+    // first switch to it calls entry(arg) on [stack, stack + size)
+    void init(void* stack, size_t size, void (*entry)(void*), void* arg)
+    {
+        uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~uintptr_t(15);
+        // the frame fiber_switch_context pops, so that its ret lands in the
+        // trampoline with a 16 byte aligned stack
+        uint64_t* frame = reinterpret_cast<uint64_t*>(top - 72);
+        frame[0] = 0x037f; // x87 control word, power-on default
+        frame[1] = 0x1f80; // mxcsr, power-on default
+        frame[2] = 0;      // r15
+        frame[3] = 0;      // r14
+        frame[4] = reinterpret_cast<uint64_t>(entry); // r13
+        frame[5] = reinterpret_cast<uint64_t>(arg);   // r12
+        frame[6] = 0;      // rbx
+        frame[7] = 0;      // rbp
+        frame[8] = reinterpret_cast<uint64_t>(&fiber_entry_trampoline);
+        sp_ = frame;
+    }
+
+    static void swap(FiberContext& from, FiberContext& to)
+    {
+        fiber_switch_context(&from.sp_, to.sp_);
+    }
+
+private:
+    void* sp_ = nullptr;
+};
+
+#else
+
+class FiberContext
+{
+public:
+    void init(void* stack, size_t size, void (*entry)(void*), void* arg)
+    {
+        getcontext(&context_);
+        context_.uc_stack.ss_sp = stack;
+        context_.uc_stack.ss_size = size;
+        context_.uc_link = nullptr;
+        entry_ = entry;
+        arg_ = arg;
+        // makecontext only passes ints
+        uintptr_t self = reinterpret_cast<uintptr_t>(this);
+        makecontext(&context_, reinterpret_cast<void (*)()>(&start), 2,
+                    unsigned(self >> 32), unsigned(self & 0xffffffff));
+    }
+
+    static void swap(FiberContext& from, FiberContext& to)
+    {
+        swapcontext(&from.context_, &to.context_);
+    }
+
+private:
+    static void start(unsigned hi, unsigned lo)
+    {
+        FiberContext* self = reinterpret_cast<FiberContext*>((uintptr_t(hi) << 32) | uintptr_t(lo));
+        self->entry_(self->arg_);
+    }
+
+    ucontext_t context_;
+    void (*entry_)(void*) = nullptr;
+    void* arg_ = nullptr;
+};
+
+#endif
+
+// STACK_SIZE usable bytes with an inaccessible page below them
+class FiberStack
+{
+public:
+    static constexpr size_t STACK_SIZE = 64 * 1024;
+
+    FiberStack() = default;
+
+    static FiberStack allocate()
+    {
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        void* base = mmap(nullptr, STACK_SIZE + page, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (base == MAP_FAILED) throw std::bad_alloc();
+        mprotect(base, page, PROT_NONE);
+
+        FiberStack stack;
+        stack.base_ = base;
+        stack.mapped_ = STACK_SIZE + page;
+        stack.page_ = page;
+        return stack;
+    }
+
+    FiberStack(FiberStack&& other) noexcept
+    : base_(std::exchange(other.base_, nullptr))
+    , mapped_(other.mapped_)
+    , page_(other.page_)
+    {
+    }
+
+    FiberStack& operator=(FiberStack&& other) noexcept
+    {
+        std::swap(base_, other.base_);
+        std::swap(mapped_, other.mapped_);
+        std::swap(page_, other.page_);
+        return *this;
+    }
+
+    ~FiberStack()
+    {
+        if (base_) munmap(base_, mapped_);
+    }
+
+    void* bottom() const { return static_cast<char*>(base_) + page_; }
+    size_t size() const { return mapped_ - page_; }
+    explicit operator bool() const { return base_ != nullptr; }
+
+private:
+    void* base_ = nullptr;
+    size_t mapped_ = 0;
+    size_t page_ = 0;
+};
+
+class FiberScheduler;
+
+// what a Fiber handle and the scheduler share, counted intrusively: the
+// handle is an IntrusivePtr, the scheduler holds one plain reference from
+// spawn() until the fiber has finished
+struct FiberControl : RefCounted<>
+{
+    // what the worker does once the fiber has switched back to it
+    enum class After
+    {
+        Yield,
+        Join,
+        Finish,
+    };
+
+    FiberContext context;
+    FiberStack stack;
+    InlineTask task;
+    FiberScheduler* scheduler = nullptr;
+    After after = After::Yield;
+    FiberControl* joinTarget = nullptr;
+
+    // finished / joiner under joinMtx; done mirrors finished for kernel
+    // threads blocked in join()
+    Mutex joinMtx{ "fiber join" };
+    bool finished = false;
+    FiberControl* joiner = nullptr;
+    std::atomic<uint32_t> done{ 0 };
+
+#ifdef FIBER_TSAN
+    void* tsanFiber = nullptr;
+#endif
+};
+
+// handle to a spawned fiber, std::thread style
+class Fiber
+{
+public:
+    Fiber() = default;
+
+    Fiber(Fiber&& other) = default;
+
+    Fiber& operator=(Fiber&& other)
+    {
+        if (joinable()) std::terminate();
+        control_ = std::move(other.control_);
+        return *this;
+    }
+
+    Fiber(const Fiber&) = delete;
+    Fiber& operator=(const Fiber&) = delete;
+
+    ~Fiber()
+    {
+        if (joinable()) std::terminate();
+    }
+
+    bool joinable() const { return bool(control_); }
+
+    // from a fiber this suspends just the fiber, from a plain thread it
+    // blocks the thread
+    void join();
+
+    void detach()
+    {
+        if (!joinable()) throw std::logic_error("Fiber is not joinable");
+        control_.reset();
+    }
+
+private:
+    friend class FiberScheduler;
+
+    explicit Fiber(IntrusivePtr<FiberControl> control)
+    : control_(std::move(control))
+    {
+    }
+
+    IntrusivePtr<FiberControl> control_{ nullptr };
+};
+
+class FiberScheduler
+{
+public:
+    // stacks kept around for reuse, the rest are unmapped
+    static constexpr size_t STACK_CACHE = 1024;
+
+    explicit FiberScheduler(size_t numThreads = std::max(1u, std::thread::hardware_concurrency()))
+    {
+        for (size_t i = 0; i < numThreads; i++)
+        {
+            workers_.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    FiberScheduler(const FiberScheduler&) = delete;
+    FiberScheduler& operator=(const FiberScheduler&) = delete;
+
+    // waits for every fiber, detached ones included, to finish
+    ~FiberScheduler()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            allDone_.wait(lock, [this]() { return live_ == 0; });
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    template<typename F, typename ...Args>
+    Fiber spawn(F&& func, Args&&... args)
+    {
+        IntrusivePtr<FiberControl> control(new FiberControl());
+        control->scheduler = this;
+        control->task = InlineTask(
+            [func = std::forward<F>(func), ...args = std::forward<Args>(args)]() mutable
+            {
+                std::invoke(std::move(func), std::move(args)...);
+            });
+        control->stack = takeStack();
+        control->context.init(control->stack.bottom(), control->stack.size(), &fiberMain, control.get());
+#ifdef FIBER_TSAN
+        control->tsanFiber = __tsan_create_fiber(0);
+#endif
+
+        // the scheduler's reference, dropped in finish()
+        control->addRef();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            live_++;
+        }
+        schedule(control.get());
+        return Fiber(std::move(control));
+    }
+
+    // lets the other fibers on this worker run; a plain thread just yields
+    static void yield()
+    {
+        FiberControl* self = current();
+        if (!self)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        self->after = FiberControl::After::Yield;
+        switchToWorker(self);
+    }
+
+    static bool inFiber() { return current() != nullptr; }
+
+private:
+    friend class Fiber;
+
+    static void fiberMain(void* arg)
+    {
+        FiberControl* self = static_cast<FiberControl*>(arg);
+        try
+        {
+            self->task();
+        }
+        catch (...)
+        {
+            std::terminate();
+        }
+        self->task.reset();
+        self->after = FiberControl::After::Finish;
+        switchToWorker(self);
+        // a finished fiber is never switched to again
+        std::terminate();
+    }
+
+    // suspends self until target has finished
+    static void joinFromFiber(FiberControl* self, FiberControl* target)
+    {
+        self->after = FiberControl::After::Join;
+        self->joinTarget = target;
+        switchToWorker(self);
+    }
+
+    static void switchToWorker(FiberControl* self)
+    {
+#ifdef FIBER_TSAN
+        __tsan_switch_to_fiber(workerTsanFiber(), 0);
+#endif
+        FiberContext::swap(self->context, *workerContext());
+    }
+
+    void schedule(FiberControl* fiber)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            queue_.push_back(fiber);
+        }
+        cv_.notify_one();
+    }
+
+    void workerLoop()
+    {
+        FiberContext context;
+        workerContext() = &context;
+#ifdef FIBER_TSAN
+        workerTsanFiber() = __tsan_get_current_fiber();
+#endif
+
+        while (true)
+        {
+            FiberControl* fiber;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+                if (queue_.empty()) return;
+                fiber = queue_.front();
+                queue_.pop_front();
+            }
+
+            current() = fiber;
+#ifdef FIBER_TSAN
+            __tsan_switch_to_fiber(fiber->tsanFiber, 0);
+#endif
+            FiberContext::swap(context, fiber->context);
+            current() = nullptr;
+
+            // the fiber's registers are saved by now, so it is safe to hand
+            // it to another worker
+            switch (fiber->after)
+            {
+            case FiberControl::After::Yield:
+                schedule(fiber);
+                break;
+            case FiberControl::After::Join:
+                parkJoiner(fiber);
+                break;
+            case FiberControl::After::Finish:
+                finish(fiber);
+                break;
+            }
+        }
+    }
+
+    void parkJoiner(FiberControl* fiber)
+    {
+        FiberControl* target = std::exchange(fiber->joinTarget, nullptr);
+        {
+            std::lock_guard<Mutex> lock(target->joinMtx);
+            if (!target->finished)
+            {
+                target->joiner = fiber;
+                return;
+            }
+        }
+        schedule(fiber);
+    }
+
+    void finish(FiberControl* fiber)
+    {
+#ifdef FIBER_TSAN
+        __tsan_destroy_fiber(std::exchange(fiber->tsanFiber, nullptr));
+#endif
+        giveBackStack(std::move(fiber->stack));
+
+        FiberControl* joiner;
+        {
+            std::lock_guard<Mutex> lock(fiber->joinMtx);
+            fiber->finished = true;
+            joiner = std::exchange(fiber->joiner, nullptr);
+        }
+        fiber->done.store(1, std::memory_order_release);
+        futexWakeAll(fiber->done);
+        if (joiner) schedule(joiner);
+
+        if (fiber->releaseRef())
+        {
+            SharedPtrTrace::destroyed(fiber);
+            delete fiber;
+        }
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            last = --live_ == 0;
+        }
+        if (last) allDone_.notify_all();
+    }
+
+    FiberStack takeStack()
+    {
+        {
+            std::lock_guard<std::mutex> lock(stackMtx_);
+            if (!freeStacks_.empty())
+            {
+                FiberStack stack = std::move(freeStacks_.back());
+                freeStacks_.pop_back();
+                return stack;
+            }
+        }
+        return FiberStack::allocate();
+    }
+
+    void giveBackStack(FiberStack stack)
+    {
+        std::lock_guard<std::mutex> lock(stackMtx_);
+        if (freeStacks_.size() < STACK_CACHE) freeStacks_.push_back(std::move(stack));
+    }
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable allDone_;
+    std::deque<FiberControl*> queue_;
+    size_t live_ = 0;
+    bool stop_ = false;
+
+    std::mutex stackMtx_;
+    std::vector<FiberStack> freeStacks_;
+
+    std::vector<std::thread> workers_;
+
+    // The worker thread's own context and the fiber it is running. A fiber
+    // can resume on another worker, so these are looked up anew on every
+    // call: inlined, the compiler could reuse a thread_local address it
+    // computed before the switch.
+    [[gnu::noinline]] static FiberContext*& workerContext()
+    {
+        static thread_local FiberContext* context = nullptr;
+        return context;
+    }
+
+    [[gnu::noinline]] static FiberControl*& current()
+    {
+        static thread_local FiberControl* fiber = nullptr;
+        return fiber;
+    }
+
+#ifdef FIBER_TSAN
+    [[gnu::noinline]] static void*& workerTsanFiber()
+    {
+        static thread_local void* fiber = nullptr;
+        return fiber;
+    }
+#endif
+};
+
+inline void Fiber::join()
+{
+    if (!joinable()) throw std::logic_error("Fiber is not joinable");
+    FiberControl* target = control_.get();
+    FiberControl* self = FiberScheduler::current();
+    if (target == self) throw std::logic_error("Fiber can't join itself");
+
+    if (self)
+    {
+        FiberScheduler::joinFromFiber(self, target);
+    }
+    else
+    {
+        while (!target->done.load(std::memory_order_acquire))
+        {
+            futexWait(target->done, 0);
+        }
+    }
+    control_.reset();
+}
+
+// shared by spawn(), one worker per core, lives until exit
+inline FiberScheduler& defaultScheduler()
+{
+    static FiberScheduler scheduler;
+    return scheduler;
+}
+
+template<typename F, typename ...Args>
+Fiber spawn(F&& func, Args&&... args)
+{
+    return defaultScheduler().spawn(std::forward<F>(func), std::forward<Args>(args)...);
+}
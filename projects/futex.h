@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Thin wrappers around the Linux futex syscall on a 32 bit atomic: park the
+ * thread while the word still holds an expected value, and wake threads
+ * parked on it. Elsewhere they fall back to C++20 atomic wait / notify
+ * (which is itself futex-backed on Linux, but hides the timed wait).
+ *
+ * Like the syscall, waits can return spuriously, so callers always recheck
+ * the word in a loop.
+ */
+
+// sleeps while word == expected
+inline void futexWait(std::atomic<uint32_t>& word, uint32_t expected)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    word.wait(expected);
+#endif
+}
+
+// same, giving up after timeout. False if it timed out.
+inline bool futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::nanoseconds timeout)
+{
+#ifdef __linux__
+    if (timeout <= std::chrono::nanoseconds::zero()) return false;
+    timespec ts;
+    ts.tv_sec = time_t(timeout.count() / 1000000000);
+    ts.tv_nsec = long(timeout.count() % 1000000000);
+    long res = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+    return !(res == -1 && errno == ETIMEDOUT);
+#else
+    // no timed atomic wait in the standard, poll instead
+    auto until = std::chrono::steady_clock::now() + timeout;
+    while (word.load() == expected)
+    {
+        if (std::chrono::steady_clock::now() >= until) return false;
+        std::this_thread::yield();
+    }
+    return true;
+#endif
+}
+
+inline void futexWake(std::atomic<uint32_t>& word, int count = 1)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+    if (count == 1)
+    {
+        word.notify_one();
+    }
+    else
+    {
+        word.notify_all();
+    }
+#endif
+}
+
+inline void futexWakeAll(std::atomic<uint32_t>& word)
+{
+    futexWake(word, INT_MAX);
+}
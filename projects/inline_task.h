@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "slab_allocator.h"
+
+/*
+ * Move-only replacement for std::function<void()>.
+ *
+ * Closures up to INLINE_SIZE bytes are stored in the object itself, so
+ * wrapping the usual lambda (a few pointers / ints of captures) never touches
+ * the heap. Bigger closures fall back to a single allocation from Allocator
+ * (see slab_allocator.h). Since it is move-only it can also hold move-only
+ * captures like std::packaged_task, which std::function can't.
+ */
+template<typename Allocator>
+class BasicInlineTask
+{
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    BasicInlineTask()
+    : ops_(nullptr)
+    {
+    }
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, BasicInlineTask>>>
+    BasicInlineTask(F&& func)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (fitsInline<Fn>())
+        {
+            new (storage_) Fn(std::forward<F>(func));
+            ops_ = &inlineOps<Fn>;
+        }
+        else
+        {
+            *reinterpret_cast<Fn**>(storage_) = create<Fn>(std::forward<F>(func));
+            ops_ = &heapOps<Fn>;
+        }
+    }
+
+    BasicInlineTask(BasicInlineTask& other) = delete;
+    BasicInlineTask& operator=(BasicInlineTask& other) = delete;
+
+    BasicInlineTask(BasicInlineTask&& other) noexcept
+    : ops_(other.ops_)
+    {
+        if (ops_)
+        {
+            ops_->move(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    BasicInlineTask& operator=(BasicInlineTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ops_ = other.ops_;
+            if (ops_)
+            {
+                ops_->move(other.storage_, storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~BasicInlineTask()
+    {
+        reset();
+    }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void reset()
+    {
+        if (ops_)
+        {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    // hand-rolled vtable, one static instance per closure type
+    struct Ops
+    {
+        void (*invoke)(void* storage);
+        void (*move)(void* from, void* to);
+        void (*destroy)(void* storage);
+    };
+
+    template<typename Fn>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Fn) <= INLINE_SIZE
+            && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+    template<typename Fn, typename F>
+    static Fn* create(F&& func)
+    {
+        void* p = Allocator::allocate(sizeof(Fn), alignof(Fn));
+        try
+        {
+            return new (p) Fn(std::forward<F>(func));
+        }
+        catch (...)
+        {
+            Allocator::deallocate(p, sizeof(Fn), alignof(Fn));
+            throw;
+        }
+    }
+
+    template<typename Fn>
+    static void destroy(Fn* fn)
+    {
+        fn->~Fn();
+        Allocator::deallocate(fn, sizeof(Fn), alignof(Fn));
+    }
+
+    template<typename Fn>
+    static constexpr Ops inlineOps =
+    {
+        [](void* storage) { (*static_cast<Fn*>(storage))(); },
+        [](void* from, void* to)
+        {
+            new (to) Fn(std::move(*static_cast<Fn*>(from)));
+            static_cast<Fn*>(from)->~Fn();
+        },
+        [](void* storage) { static_cast<Fn*>(storage)->~Fn(); },
+    };
+
+    template<typename Fn>
+    static constexpr Ops heapOps =
+    {
+        [](void* storage) { (**static_cast<Fn**>(storage))(); },
+        [](void* from, void* to) { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); },
+        [](void* storage) { destroy(*static_cast<Fn**>(storage)); },
+    };
+
+    const Ops* ops_;
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+};
+
+// what ThreadPool queues: big closures come from the calling thread's slab
+// cache, and go back to it when a worker is done with them
+using InlineTask = BasicInlineTask<SlabAllocator>;
@@ -0,0 +1,125 @@
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "lock_bench.h"
+#include "my_mutex.h"
+#include "sharded_counter.h"
+
+/*
+ * Every way this repo bumps a shared counter, head to head: the five
+ * strategies of mutex.cpp (func .. func5), the two of threads.cpp
+ * (increment_glob_mutex / increment_glob_lockguard, minus its printout),
+ * our Mutex in both fairness modes and ShardedCounter, which doesn't lock
+ * at all. See lock_bench.h for the options, e.g.
+ *
+ *   ./lock_bench --label=$(git rev-parse --short HEAD) --csv=locks.csv
+ */
+
+// what all the lock cases guard
+struct Guarded
+{
+    std::mutex m, m1, m2;
+    long long i = 0;
+};
+
+template<typename F>
+LockBench::Factory guarded(F increment)
+{
+    return [increment]()
+    {
+        auto state = std::make_shared<Guarded>();
+        return LockBench::Op([state, increment]() { increment(*state); });
+    };
+}
+
+int main(int argc, char** argv)
+try
+{
+    LockBench bench(argc, argv);
+
+    // mutex.cpp
+    bench.add("LOCK_GUARD", guarded([](Guarded& g)
+    {
+        std::lock_guard<std::mutex> guard(g.m);
+        g.i += 1;
+    }));
+
+    bench.add("STD_LOCK_ADOPT", guarded([](Guarded& g)
+    {
+        std::lock(g.m1, g.m2);
+        std::lock_guard<std::mutex> guard1(g.m1, std::adopt_lock);
+        std::lock_guard<std::mutex> guard2(g.m2, std::adopt_lock);
+        g.i += 1;
+    }));
+
+    bench.add("ATOMIC_INT", []()
+    {
+        auto ai = std::make_shared<std::atomic_int>(0);
+        return LockBench::Op([ai]() { *ai += 1; });
+    });
+
+    bench.add("SCOPED_LOCK_3", guarded([](Guarded& g)
+    {
+        std::scoped_lock guard(g.m, g.m1, g.m2);
+        g.i += 1;
+    }));
+
+    bench.add("UNIQUE_LOCK_DEFER", guarded([](Guarded& g)
+    {
+        std::unique_lock<std::mutex> guard(g.m, std::defer_lock);
+        guard.lock();
+        g.i += 1;
+    }));
+
+    // threads.cpp
+    bench.add("LOCK_UNLOCK", guarded([](Guarded& g)
+    {
+        g.m.lock();
+        g.i++;
+        g.m.unlock();
+    }));
+
+    bench.add("LOCK_GUARD_THROW", guarded([](Guarded& g)
+    {
+        std::lock_guard<std::mutex> guard(g.m);
+        try
+        {
+            g.i++;
+            throw "Forced error thrown...";
+        }
+        catch (...)
+        {
+        }
+    }));
+
+    // projects/my_mutex.h
+    bench.add("MUTEX_BARGING", []()
+    {
+        auto mtx = std::make_shared<Mutex>("bench barging");
+        auto i = std::make_shared<long long>(0);
+        return LockBench::Op([mtx, i]() { std::lock_guard<Mutex> guard(*mtx); (*i)++; });
+    });
+
+    bench.add("MUTEX_FIFO", []()
+    {
+        auto mtx = std::make_shared<Mutex>("bench fifo", Mutex::Fairness::Fifo);
+        auto i = std::make_shared<long long>(0);
+        return LockBench::Op([mtx, i]() { std::lock_guard<Mutex> guard(*mtx); (*i)++; });
+    });
+
+    // projects/sharded_counter.h
+    bench.add("SHARDED_COUNTER", []()
+    {
+        auto counter = std::make_shared<ShardedCounter>();
+        return LockBench::Op([counter]() { counter->add(1); });
+    });
+
+    bench.run();
+    return 0;
+}
+catch (std::exception& e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
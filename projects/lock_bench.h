@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cycle_clock.h"
+#include "pool_stats.h"
+
+/*
+ * Tiny self-contained benchmark harness for "N threads hammer one thing"
+ * cases, Google Benchmark style: register cases, run() sweeps them over
+ * thread counts and repetitions and writes one CSV row per run.
+ *
+ * A case is a factory returning the per-run operation, so every run starts
+ * from fresh state:
+ *
+ *   bench.add("LOCK_GUARD", []()
+ *   {
+ *       auto state = std::make_shared<State>();
+ *       return [state]() { std::lock_guard<std::mutex> g(state->m); state->i++; };
+ *   });
+ *
+ * Each case and thread count gets one unreported warm-up run first.
+ * Throughput is total ops over wall time, from the moment all threads are
+ * released at once until the last one is done. Latency is taken on every
+ * SAMPLE_EVERY-th op only (so the timer doesn't dominate short ops) and
+ * includes one cycle counter read.
+ *
+ * Command line (all optional):
+ *   --threads=N       largest thread count, doubling from 1 (default 2x cores)
+ *   --iterations=N    ops per thread and run (default 100000)
+ *   --repetitions=N   runs per case and thread count (default 3)
+ *   --filter=TEXT     only cases whose name contains TEXT
+ *   --label=TEXT      first CSV column, to tell builds apart (default "default")
+ *   --csv=PATH        write the CSV there instead of stdout
+ */
+class LockBench
+{
+public:
+    using Op = std::function<void()>;
+    using Factory = std::function<Op()>;
+
+    static constexpr uint64_t SAMPLE_EVERY = 8;
+
+    LockBench(int argc, char** argv)
+    : maxThreads_(2 * std::max(1u, std::thread::hardware_concurrency()))
+    , iterations_(100000)
+    , repetitions_(3)
+    , label_("default")
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (!parse(arg, "--threads=", maxThreads_)
+                && !parse(arg, "--iterations=", iterations_)
+                && !parse(arg, "--repetitions=", repetitions_)
+                && !parse(arg, "--filter=", filter_)
+                && !parse(arg, "--label=", label_)
+                && !parse(arg, "--csv=", csvPath_))
+            {
+                throw std::invalid_argument("unknown argument " + arg);
+            }
+        }
+    }
+
+    void add(std::string name, Factory factory)
+    {
+        cases_.push_back({ std::move(name), std::move(factory) });
+    }
+
+    void run()
+    {
+        std::ofstream file;
+        if (!csvPath_.empty())
+        {
+            file.open(csvPath_);
+            if (!file) throw std::runtime_error("can't write " + csvPath_);
+        }
+        std::ostream& out = csvPath_.empty() ? std::cout : file;
+
+        out << "label,case,threads,repetition,ops,seconds,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n";
+        for (size_t threads = 1; threads <= maxThreads_; threads *= 2)
+        {
+            for (const Case& c : cases_)
+            {
+                if (!filter_.empty() && c.name.find(filter_) == std::string::npos) continue;
+                // warm up caches, allocator and frequency, not reported
+                runOnce(c, threads);
+                for (size_t rep = 0; rep < repetitions_; rep++)
+                {
+                    writeRow(out, c.name, threads, rep, runOnce(c, threads));
+                }
+            }
+        }
+
+        if (!csvPath_.empty()) std::cout << "WROTE " << csvPath_ << std::endl;
+    }
+
+private:
+    struct Case
+    {
+        std::string name;
+        Factory factory;
+    };
+
+    struct Result
+    {
+        uint64_t ops;
+        double seconds;
+        HistogramSnapshot latency; // ns
+    };
+
+    Result runOnce(const Case& c, size_t numThreads)
+    {
+        Op op = c.factory();
+        std::vector<std::unique_ptr<LatencyHistogram>> latencies;
+        std::atomic<size_t> ready = 0;
+        std::atomic<bool> go = false;
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < numThreads; t++)
+        {
+            LatencyHistogram* latency = latencies.emplace_back(std::make_unique<LatencyHistogram>()).get();
+            threads.emplace_back([&, latency]()
+            {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+
+                for (uint64_t i = 0; i < iterations_; i++)
+                {
+                    if (i % SAMPLE_EVERY != 0)
+                    {
+                        op();
+                        continue;
+                    }
+                    uint64_t start = CycleClock::now();
+                    op();
+                    latency->record(CycleClock::toNanos(CycleClock::now() - start));
+                }
+            });
+        }
+
+        while (ready.load() != numThreads) std::this_thread::yield();
+        auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        Result result{ iterations_ * numThreads, seconds, {} };
+        for (auto& latency : latencies) latency->addTo(result.latency);
+        return result;
+    }
+
+    void writeRow(std::ostream& out, const std::string& name, size_t threads, size_t rep, const Result& r)
+    {
+        out << label_ << "," << name << "," << threads << "," << rep << "," << r.ops << "," << r.seconds
+            << "," << uint64_t(double(r.ops) / r.seconds)
+            << "," << r.latency.mean() << "," << r.latency.percentile(50) << "," << r.latency.percentile(90)
+            << "," << r.latency.percentile(99) << "," << r.latency.percentile(99.9) << "," << r.latency.max << "\n";
+    }
+
+    static bool parse(const std::string& arg, const std::string& flag, std::string& value)
+    {
+        if (arg.rfind(flag, 0) != 0) return false;
+        value = arg.substr(flag.size());
+        return true;
+    }
+
+    static bool parse(const std::string& arg, const std::string& flag, size_t& value)
+    {
+        std::string text;
+        if (!parse(arg, flag, text)) return false;
+        value = std::stoull(text);
+        return true;
+    }
+
+    size_t maxThreads_;
+    size_t iterations_;
+    size_t repetitions_;
+    std::string filter_;
+    std::string label_;
+    std::string csvPath_;
+    std::vector<Case> cases_;
+};
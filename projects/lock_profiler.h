@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cycle_clock.h"
+
+/*
+ * Contention profiler for Mutex, compiled in with -DMUTEX_PROFILING=1.
+ *
+ * Every unlock() records how long the holder waited for the lock, how long
+ * it held it and whether it had to wait at all, into a buffer owned by the
+ * unlocking thread (relaxed single-writer counters, no locks, no shared
+ * cache lines). report() merges all threads' buffers and ranks the locks by
+ * total wait time; the same report is printed to stderr at exit.
+ *
+ * Locks are told apart by instance; the name passed to Mutex's constructor
+ * has to outlive the report (a string literal, typically).
+ *
+ * Compiled out, MutexProfile is an empty member and every hook an empty
+ * inline function.
+ */
+
+#ifndef MUTEX_PROFILING
+#define MUTEX_PROFILING 0
+#endif
+
+inline constexpr bool MUTEX_PROFILING_ENABLED = MUTEX_PROFILING;
+
+class LockProfiler
+{
+public:
+    // one lock as seen by one thread
+    struct Entry
+    {
+        std::atomic<uint64_t> id{ 0 }; // 0 = free slot
+        const char* name = nullptr;
+        std::atomic<uint64_t> acquisitions{ 0 };
+        std::atomic<uint64_t> contended{ 0 };
+        std::atomic<uint64_t> waitTicks{ 0 };
+        std::atomic<uint64_t> maxWaitTicks{ 0 };
+        std::atomic<uint64_t> holdTicks{ 0 };
+        std::atomic<uint64_t> maxHoldTicks{ 0 };
+    };
+
+    // merged over all threads
+    struct LockReport
+    {
+        uint64_t id = 0;
+        const char* name = nullptr;
+        uint64_t acquisitions = 0;
+        uint64_t contended = 0;
+        uint64_t waitNs = 0;
+        uint64_t maxWaitNs = 0;
+        uint64_t holdNs = 0;
+        uint64_t maxHoldNs = 0;
+        std::thread::id topHolder; // thread that held it the longest in total
+        uint64_t topHolderNs = 0;
+    };
+
+    static uint64_t newLockId()
+    {
+        static std::atomic<uint64_t> nextId{ 1 };
+        return nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void record(uint64_t id, const char* name, bool contended, uint64_t waitTicks, uint64_t holdTicks)
+    {
+        Entry& entry = localBuffer().find(id, name);
+        bump(entry.acquisitions, 1);
+        if (contended) bump(entry.contended, 1);
+        bump(entry.waitTicks, waitTicks);
+        bump(entry.holdTicks, holdTicks);
+        raise(entry.maxWaitTicks, waitTicks);
+        raise(entry.maxHoldTicks, holdTicks);
+    }
+
+    // all locks seen so far, worst total wait first
+    static std::vector<LockReport> collect()
+    {
+        std::map<uint64_t, LockReport> merged;
+        std::map<uint64_t, std::map<std::thread::id, uint64_t>> holdByThread;
+
+        Registry& registry = Registry::instance();
+        std::lock_guard<std::mutex> lock(registry.mtx);
+        for (const std::shared_ptr<ThreadBuffer>& buffer : registry.buffers)
+        {
+            for (const Entry& entry : buffer->entries)
+            {
+                uint64_t id = entry.id.load(std::memory_order_acquire);
+                if (id == 0) continue;
+
+                LockReport& report = merged[id];
+                report.id = id;
+                report.name = entry.name;
+                report.acquisitions += entry.acquisitions.load(std::memory_order_relaxed);
+                report.contended += entry.contended.load(std::memory_order_relaxed);
+                report.waitNs += CycleClock::toNanos(entry.waitTicks.load(std::memory_order_relaxed));
+                report.maxWaitNs = std::max(report.maxWaitNs, CycleClock::toNanos(entry.maxWaitTicks.load(std::memory_order_relaxed)));
+                uint64_t holdNs = CycleClock::toNanos(entry.holdTicks.load(std::memory_order_relaxed));
+                report.holdNs += holdNs;
+                report.maxHoldNs = std::max(report.maxHoldNs, CycleClock::toNanos(entry.maxHoldTicks.load(std::memory_order_relaxed)));
+                holdByThread[id][buffer->thread] += holdNs;
+            }
+        }
+
+        std::vector<LockReport> out;
+        for (auto& [id, report] : merged)
+        {
+            for (auto& [thread, holdNs] : holdByThread[id])
+            {
+                if (holdNs >= report.topHolderNs)
+                {
+                    report.topHolder = thread;
+                    report.topHolderNs = holdNs;
+                }
+            }
+            out.push_back(report);
+        }
+        std::sort(out.begin(), out.end(), [](const LockReport& a, const LockReport& b) { return a.waitNs > b.waitNs; });
+        return out;
+    }
+
+    static void report(std::ostream& out, size_t top = 20)
+    {
+        std::vector<LockReport> locks = collect();
+        out << "LOCK PROFILE (" << locks.size() << " locks, by total wait)\n";
+        for (size_t i = 0; i < locks.size() && i < top; i++)
+        {
+            const LockReport& lock = locks[i];
+            out << std::setw(3) << i + 1 << ". " << (lock.name ? lock.name : "<unnamed>") << "#" << lock.id
+                << " acquired:" << lock.acquisitions
+                << " contended:" << lock.contended
+                << " wait(us) total:" << lock.waitNs / 1000.0 << " max:" << lock.maxWaitNs / 1000.0
+                << " hold(us) total:" << lock.holdNs / 1000.0 << " max:" << lock.maxHoldNs / 1000.0
+                << " top holder:" << lock.topHolder << "\n";
+        }
+    }
+
+private:
+    static constexpr size_t BUFFER_SLOTS = 256;
+
+    static constexpr uint64_t OVERFLOW_ID = UINT64_MAX;
+
+    // open addressing on the lock id, only the owning thread inserts. Once
+    // full, further locks are lumped together in one extra slot.
+    struct ThreadBuffer
+    {
+        std::thread::id thread = std::this_thread::get_id();
+        std::array<Entry, BUFFER_SLOTS + 1> entries;
+
+        Entry& find(uint64_t id, const char* name)
+        {
+            size_t start = size_t(id * 0x9E3779B97F4A7C15ull) % BUFFER_SLOTS;
+            for (size_t i = 0; i < BUFFER_SLOTS; i++)
+            {
+                size_t slot = (start + i) % BUFFER_SLOTS;
+                uint64_t current = entries[slot].id.load(std::memory_order_relaxed);
+                if (current == id) return entries[slot];
+                if (current == 0)
+                {
+                    entries[slot].name = name;
+                    entries[slot].id.store(id, std::memory_order_release);
+                    return entries[slot];
+                }
+            }
+
+            Entry& overflow = entries[BUFFER_SLOTS];
+            if (overflow.id.load(std::memory_order_relaxed) == 0)
+            {
+                overflow.name = "<other locks>";
+                overflow.id.store(OVERFLOW_ID, std::memory_order_release);
+            }
+            return overflow;
+        }
+    };
+
+    // buffers stay registered after their thread exits, so its numbers
+    // still show up in the report
+    struct Registry
+    {
+        ~Registry()
+        {
+            bool any = false;
+            for (const std::shared_ptr<ThreadBuffer>& buffer : buffers)
+            {
+                for (const Entry& entry : buffer->entries) any = any || entry.id.load() != 0;
+            }
+            if (any) report(std::cerr);
+        }
+
+        static Registry& instance()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        std::mutex mtx;
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    };
+
+    static ThreadBuffer& localBuffer()
+    {
+        static thread_local std::shared_ptr<ThreadBuffer> buffer = []()
+        {
+            auto created = std::make_shared<ThreadBuffer>();
+            Registry& registry = Registry::instance();
+            std::lock_guard<std::mutex> lock(registry.mtx);
+            registry.buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    static void raise(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        if (value > counter.load(std::memory_order_relaxed)) counter.store(value, std::memory_order_relaxed);
+    }
+};
+
+// what a Mutex carries around for the profiler, nothing when compiled out.
+// Apart from owner_ only touched by whoever holds the lock.
+class MutexProfile
+{
+public:
+#if MUTEX_PROFILING
+    explicit MutexProfile(const char* name)
+    : id_(LockProfiler::newLockId())
+    , name_(name)
+    , acquiredAt_(0)
+    , waitTicks_(0)
+    , contended_(false)
+    {
+    }
+
+    uint64_t now() const { return CycleClock::now(); }
+
+    void acquired(uint64_t start, bool contended)
+    {
+        acquiredAt_ = CycleClock::now();
+        waitTicks_ = acquiredAt_ - start;
+        contended_ = contended;
+        owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    }
+
+    void releasing()
+    {
+        if (acquiredAt_ == 0) return; // not locked, unlock() is about to throw
+        LockProfiler::record(id_, name_, contended_, waitTicks_, CycleClock::now() - acquiredAt_);
+        acquiredAt_ = 0;
+        owner_.store(std::thread::id(), std::memory_order_relaxed);
+    }
+
+    std::thread::id owner() const { return owner_.load(std::memory_order_relaxed); }
+
+private:
+    uint64_t id_;
+    const char* name_;
+    uint64_t acquiredAt_;
+    uint64_t waitTicks_;
+    bool contended_;
+    std::atomic<std::thread::id> owner_;
+#else
+    explicit MutexProfile(const char*) {}
+
+    uint64_t now() const { return 0; }
+    void acquired(uint64_t, bool) {}
+    void releasing() {}
+    std::thread::id owner() const { return std::thread::id(); }
+#endif
+};
@@ -0,0 +1,130 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "mpmc_queue.h"
+
+/*
+ * PRODUCERS threads push ITEMS numbers each through a CAPACITY slot channel
+ * that CONSUMERS threads drain, once with MpmcQueue and once with the usual
+ * std::queue + mutex + two condition variables. The channel is small so
+ * both the full and the empty side get to block.
+ */
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS 250000
+#define CAPACITY 64
+
+using Clock = std::chrono::steady_clock;
+
+// the mutex / condition_variable channel it replaces
+class LockedChannel
+{
+public:
+    bool push(long long item)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        notFull_.wait(lock, [this]() { return closed_ || items_.size() < CAPACITY; });
+        if (closed_) return false;
+        items_.push(item);
+        lock.unlock();
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    bool pop(long long& out)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        notEmpty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty()) return false;
+        out = items_.front();
+        items_.pop();
+        lock.unlock();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            closed_ = true;
+        }
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::queue<long long> items_;
+    bool closed_ = false;
+};
+
+template<typename Channel>
+void run(const char* name, Channel& channel)
+{
+    std::atomic<long long> sum = 0;
+    auto start = Clock::now();
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < CONSUMERS; c++)
+    {
+        consumers.emplace_back([&]()
+        {
+            long long item;
+            long long local = 0;
+            while (channel.pop(item)) local += item;
+            sum += local;
+        });
+    }
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        producers.emplace_back([&]()
+        {
+            for (long long i = 1; i <= ITEMS; i++) channel.push(i);
+        });
+    }
+    for (std::thread& producer : producers) producer.join();
+    channel.close();
+    for (std::thread& consumer : consumers) consumer.join();
+
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    long long expected = PRODUCERS * (ITEMS * (ITEMS + 1LL) / 2);
+    std::cout << std::boolalpha << name << " SUM:" << sum << " " << (sum == expected)
+              << " NS/ITEM:" << ns / (double(PRODUCERS) * ITEMS) << std::endl;
+}
+
+int main()
+{
+    LockedChannel locked;
+    run("MUTEX_CV", locked);
+    MpmcQueue<long long> queue(CAPACITY);
+    run("MPMC    ", queue);
+
+    // non-blocking and timed ends
+    MpmcQueue<int> small(2);
+    int item = 0;
+    bool tryOk = !small.tryPop(item) && small.tryPush(1) && small.tryPush(2) && !small.tryPush(3);
+    std::cout << "CAPACITY:" << small.capacity() << " TRY:" << tryOk << std::endl;
+
+    auto start = Clock::now();
+    bool pushed = small.pushFor(3, std::chrono::milliseconds(20));
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+    std::cout << "PUSH_FOR FULL:" << pushed << " WAITED(ms):" << waited.count() << " " << (!pushed && waited.count() >= 20) << std::endl;
+
+    // close() lets pop() drain what is left, then fail
+    small.close();
+    int a = 0, b = 0;
+    bool drained = small.pop(a) && small.pop(b) && !small.pop(item) && !small.push(4);
+    std::cout << "CLOSED DRAINS:" << (drained && a == 1 && b == 2) << std::endl;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "event_count.h"
+#include "spin_wait.h"
+
+/*
+ * Bounded multi-producer multi-consumer queue (Dmitry Vyukov's ring): a
+ * power of two array of cells, each with a sequence number saying whose
+ * turn it is. A producer claims the cell at enqueuePos_ when its sequence
+ * equals the position, fills it and bumps the sequence by one; a consumer
+ * claims the cell at dequeuePos_ when the sequence is one past the
+ * position, empties it and bumps it by a full lap. One CAS per operation,
+ * and producers and consumers only meet on cells, not on a shared lock.
+ *
+ * tryPush() / tryPop() never block. push() / pop() spin for a bit and then
+ * park on an EventCount, but only while the queue is full / empty; the
+ * other side skips the wake-up syscall unless someone is actually parked.
+ * pushFor() / popFor() give up after a timeout.
+ *
+ * As a channel: close() makes pushes fail and wakes everyone; pop() keeps
+ * returning what is left and then false.
+ */
+template<typename T>
+class MpmcQueue
+{
+public:
+    // rounded up to a power of two
+    explicit MpmcQueue(size_t capacity)
+    : mask_(roundUp(capacity) - 1)
+    , cells_(std::make_unique<Cell[]>(mask_ + 1))
+    {
+        for (size_t i = 0; i <= mask_; i++)
+        {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    ~MpmcQueue()
+    {
+        // whatever nobody popped
+        size_t end = enqueuePos_.load(std::memory_order_relaxed);
+        for (size_t pos = dequeuePos_.load(std::memory_order_relaxed); pos != end; pos++)
+        {
+            cells_[pos & mask_].item()->~T();
+        }
+    }
+
+    // false if full or closed; item is only moved from on success
+    template<typename U>
+    bool tryPush(U&& item)
+    {
+        if (closed_.load(std::memory_order_relaxed)) return false;
+
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            intptr_t diff = intptr_t(cell->seq.load(std::memory_order_acquire)) - intptr_t(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0)
+            {
+                // a lap behind: the consumer hasn't emptied it yet
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->storage) T(std::forward<U>(item));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        notEmpty_.notify();
+        return true;
+    }
+
+    // false if empty
+    bool tryPop(T& out)
+    {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            intptr_t diff = intptr_t(cell->seq.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        T* item = cell->item();
+        out = std::move(*item);
+        item->~T();
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        notFull_.notify();
+        return true;
+    }
+
+    // blocks while full. False if closed.
+    template<typename U>
+    bool push(U&& item)
+    {
+        return waitFor(notFull_, NO_TIMEOUT, [&]() { return tryPush(std::forward<U>(item)); }, [&]() { return closed(); });
+    }
+
+    // blocks while empty. False once closed and drained.
+    bool pop(T& out)
+    {
+        return waitFor(notEmpty_, NO_TIMEOUT, [&]() { return tryPop(out); }, [&]() { return closed(); });
+    }
+
+    template<typename U>
+    bool pushFor(U&& item, std::chrono::nanoseconds timeout)
+    {
+        return waitFor(notFull_, timeout, [&]() { return tryPush(std::forward<U>(item)); }, [&]() { return closed(); });
+    }
+
+    bool popFor(T& out, std::chrono::nanoseconds timeout)
+    {
+        return waitFor(notEmpty_, timeout, [&]() { return tryPop(out); }, [&]() { return closed(); });
+    }
+
+    void close()
+    {
+        closed_.store(true);
+        notEmpty_.notifyAll();
+        notFull_.notifyAll();
+    }
+
+    bool closed() const { return closed_.load(); }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // only a snapshot while others push and pop
+    size_t sizeApprox() const
+    {
+        size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+        size_t head = dequeuePos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+private:
+    static constexpr std::chrono::nanoseconds NO_TIMEOUT = std::chrono::nanoseconds::max();
+
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    // tryOnce until it works, parking on event in between; false on
+    // timeout, or when tryOnce still fails once done() is true
+    template<typename Try, typename Done>
+    static bool waitFor(EventCount& event, std::chrono::nanoseconds timeout, Try&& tryOnce, Done&& done)
+    {
+        SpinWait spin;
+        while (!spin.exhausted())
+        {
+            if (tryOnce()) return true;
+            // one more try for whatever got in just before close()
+            if (done()) return tryOnce();
+            spin.spinOnce();
+        }
+
+        auto until = timeout == NO_TIMEOUT ? std::chrono::steady_clock::time_point::max()
+                                           : std::chrono::steady_clock::now() + timeout;
+        for (;;)
+        {
+            EventCount::Key key = event.prepareWait();
+            if (tryOnce())
+            {
+                event.cancelWait();
+                return true;
+            }
+            if (done())
+            {
+                event.cancelWait();
+                return tryOnce();
+            }
+
+            if (timeout == NO_TIMEOUT)
+            {
+                event.commitWait(key);
+            }
+            else if (!event.commitWaitFor(key, until - std::chrono::steady_clock::now()))
+            {
+                return tryOnce();
+            }
+        }
+    }
+
+    static size_t roundUp(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        return size;
+    }
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    std::atomic<bool> closed_{ false };
+
+    // each on its own line, producers and consumers don't share them
+    alignas(64) std::atomic<size_t> enqueuePos_{ 0 };
+    alignas(64) std::atomic<size_t> dequeuePos_{ 0 };
+    alignas(64) EventCount notEmpty_;
+    alignas(64) EventCount notFull_;
+};
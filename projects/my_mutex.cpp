@@ -1,5 +1,6 @@
 #include "my_mutex.h"
 
+#include <ctime>
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -10,10 +11,9 @@
 
 using namespace std::chrono_literals;
 
-Mutex mtx;
 int glob = 0;
 
-void foo(int id)
+void foo(Mutex& mtx, int id)
 {
     int val = rand();
 
@@ -37,8 +37,12 @@ void foo(int id)
 #endif
 }
 
-int main()
+// NUM_THREADS threads that all pile up on mtx while main holds it
+void run(const char* name, Mutex& mtx)
 {
+    glob = 0;
+    std::clock_t cpuStart = std::clock();
+
     std::vector<std::thread> threads;
     mtx.lock();
 
@@ -48,7 +52,7 @@ int main()
 
     for (size_t i = 1; i <= NUM_THREADS; i++)
     {
-        threads.emplace_back(foo, i);
+        threads.emplace_back(foo, std::ref(mtx), i);
     }
 
 #if DEBUG
@@ -66,5 +70,29 @@ int main()
         threads[i].join();
     }
 
-    std::cout << std::boolalpha << "GLOB:" << glob << " " << (glob == NUM_THREADS) << std::endl;
+    double cpuMs = double(std::clock() - cpuStart) * 1000 / CLOCKS_PER_SEC;
+    std::cout << std::boolalpha << name << " GLOB:" << glob << " " << (glob == NUM_THREADS)
+              << " CPU(ms):" << cpuMs << std::endl;
+}
+
+int main()
+{
+    Mutex barging("barging");
+    Mutex fifo("fifo", Mutex::Fairness::Fifo);
+    run("BARGING", barging);
+    run("FIFO   ", fifo);
+
+    bool threw = false;
+    try
+    {
+        barging.unlock();
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    std::cout << "UNLOCK UNLOCKED THROWS:" << threw << std::endl;
+
+    // build with -DMUTEX_PROFILING=1
+    if constexpr (MUTEX_PROFILING_ENABLED) LockProfiler::report(std::cout);
 }
\ No newline at end of file
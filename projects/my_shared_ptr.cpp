@@ -1,6 +1,91 @@
 #include "my_shared_ptr.h"
 
 #include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define NUM_THREADS 8
+#define COPIES_PER_THREAD 100000
+#define LIST_SIZE 1000
+
+// containers only move elements they can move without throwing
+static_assert(std::is_nothrow_move_constructible_v<MySharedPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<MySharedPtr<int>>);
+static_assert(std::is_nothrow_move_constructible_v<MyWeakPtr<int>>);
+
+// carries its own count, so IntrusivePtr<Node> is a plain pointer
+struct Node : RefCounted<>
+{
+    explicit Node(int v)
+    : value(v)
+    {
+    }
+
+    // another owner, straight from this
+    IntrusivePtr<Node> self() { return IntrusivePtr<Node>(this); }
+
+    int value;
+};
+
+// singly linked list, each item owned by the one before it
+struct ListItem
+{
+    explicit ListItem(int v)
+    : value(v)
+    , next(nullptr)
+    {
+    }
+
+    int value;
+    MySharedPtr<ListItem> next;
+};
+
+// same, counted intrusively
+struct IntrusiveItem : RefCounted<>
+{
+    explicit IntrusiveItem(int v)
+    : value(v)
+    , next(nullptr)
+    {
+    }
+
+    int value;
+    IntrusivePtr<IntrusiveItem> next;
+};
+
+static_assert(sizeof(IntrusivePtr<IntrusiveItem>) == sizeof(IntrusiveItem*));
+static_assert(std::is_nothrow_move_constructible_v<IntrusivePtr<IntrusiveItem>>);
+
+template<typename Ptr>
+Ptr makeList()
+{
+    Ptr head(nullptr);
+    for (int i = LIST_SIZE; i > 0; i--)
+    {
+        Ptr item(i);
+        item->next = head;
+        head = item;
+    }
+    return head;
+}
+
+// cursor = cursor->next frees the item cursor pointed at, and with it
+// the next being assigned from; the new reference has to be taken first
+template<typename Ptr>
+bool walkList(bool move)
+{
+    Ptr cursor = makeList<Ptr>();
+    long long sum = 0;
+    while (cursor)
+    {
+        sum += cursor->value;
+        if (move) cursor = std::move(cursor->next);
+        else cursor = cursor->next;
+    }
+    return sum == LIST_SIZE * (LIST_SIZE + 1LL) / 2;
+}
 
 void foo(MySharedPtr<int> ptr)
 {
@@ -17,8 +102,10 @@ int main()
         std::cout << "USERS:" << obj.getCount() << std::endl;
         std::cout << "USERS:" << newobj.getCount() << std::endl;
 
-        MySharedPtr<int> newobjmoved(std::move(obj));
-        std::cout << "USERS:" << newobj.getCount() << std::endl;
+        // a move hands the reference over, the count stays the same
+        MySharedPtr<int> newobjmoved(std::move(newobj));
+        std::cout << "USERS:" << newobjmoved.getCount() << std::endl;
+        std::cout << "MOVED FROM USERS:" << newobj.getCount() << std::endl;
     }
 
     std::cout << "USERS:" << obj.getCount() << std::endl;
@@ -41,4 +128,60 @@ int main()
 
     std::cout << "OBJ VALUE:" << *obj << std::endl;
     std::cout << "NEWOBJ VALUE:" << *newobj << std::endl;
-}
\ No newline at end of file
+
+    // copies made and dropped on many threads at once, count has to end up
+    // where it started
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NUM_THREADS; i++)
+    {
+        threads.emplace_back([&obj]()
+        {
+            for (size_t j = 0; j < COPIES_PER_THREAD; j++)
+            {
+                MySharedPtr<int> copy(obj);
+                (void)*copy;
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    std::cout << std::boolalpha << "THREADS USERS:" << obj.getCount() << " " << (obj.getCount() == 2) << std::endl;
+
+    LocalSharedPtr<std::string> local = makeShared<std::string, PlainRefCount>(3, 'x');
+    LocalSharedPtr<std::string> localCopy(local);
+    std::cout << "LOCAL VALUE:" << *localCopy << " USERS:" << local.getCount() << " SIZE:" << local->size() << std::endl;
+
+    // weak references see the object go away and can't bring it back
+    MyWeakPtr<std::string> weak;
+    {
+        MySharedPtr<std::string> text("hello");
+        weak = text;
+        MySharedPtr<std::string> locked = weak.lock();
+        std::cout << "WEAK LOCKED:" << *locked << " USERS:" << weak.getCount() << std::endl;
+    }
+    std::cout << "WEAK EXPIRED:" << weak.expired() << " " << (!weak.lock()) << std::endl;
+
+    // aliasing: a pointer to a member that keeps the whole pair alive
+    MySharedPtr<std::pair<int, std::string>> pair(1, "one");
+    MySharedPtr<std::string> second(pair, &pair->second);
+    pair.reset();
+    std::cout << "ALIAS VALUE:" << *second << " USERS:" << second.getCount() << std::endl;
+
+    IntrusivePtr<Node> node(7);
+    IntrusivePtr<Node> fromThis = node->self();
+    std::cout << "INTRUSIVE VALUE:" << fromThis->value << " USERS:" << node.getCount()
+              << " ONE WORD:" << (sizeof(node) == sizeof(Node*)) << std::endl;
+
+    // object and count in one block from the calling thread's slab cache
+    MySharedPtr<std::string> pooled = allocateShared<std::string, SlabAllocator>("pooled");
+    MyWeakPtr<std::string> pooledWeak(pooled);
+    pooled.reset();
+    std::cout << "SLAB EXPIRED:" << pooledWeak.expired() << std::endl;
+
+    std::cout << "LIST COPY WALK:" << walkList<MySharedPtr<ListItem>>(false) << std::endl;
+    std::cout << "LIST MOVE WALK:" << walkList<MySharedPtr<ListItem>>(true) << std::endl;
+    std::cout << "INTRUSIVE LIST COPY WALK:" << walkList<IntrusivePtr<IntrusiveItem>>(false) << std::endl;
+    std::cout << "INTRUSIVE LIST MOVE WALK:" << walkList<IntrusivePtr<IntrusiveItem>>(true) << std::endl;
+
+    // build with -DSHARED_PTR_TRACE=1 (counts) or 2 (recent events)
+    SharedPtrTrace::dump(std::cout);
+}
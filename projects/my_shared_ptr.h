@@ -1,48 +1,423 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <functional>
-#include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "shared_ptr_trace.h"
+#include "slab_allocator.h"
+
+/*
+ * Reference count policies for MySharedPtr.
+ *
+ * AtomicRefCount (default) lets copies of one pointer live on any number of
+ * threads. PlainRefCount is a bare size_t, for pointers that never leave the
+ * thread that made them, where the locked increment / decrement would be
+ * wasted.
+ */
+class AtomicRefCount
+{
+public:
+    explicit AtomicRefCount(size_t count)
+    : count_(count)
+    {
+    }
+
+    // a new reference is always made from an existing one, which keeps the
+    // object alive on its own, so there is nothing to order
+    void increment() { count_.fetch_add(1, std::memory_order_relaxed); }
+
+    // true for the last reference. release so every owner's writes to the
+    // object happen before its destruction, acquire so whoever destroys it
+    // sees them
+    bool decrement() { return count_.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+
+    // for turning a weak reference into a strong one, fails once the last
+    // strong one is gone
+    bool incrementIfNonZero()
+    {
+        size_t count = count_.load(std::memory_order_relaxed);
+        while (count != 0)
+        {
+            if (count_.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) return true;
+        }
+        return false;
+    }
+
+    size_t load() const { return count_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<size_t> count_;
+};
+
+class PlainRefCount
+{
+public:
+    explicit PlainRefCount(size_t count)
+    : count_(count)
+    {
+    }
+
+    void increment() { count_++; }
+    bool decrement() { return --count_ == 0; }
+
+    bool incrementIfNonZero()
+    {
+        if (count_ == 0) return false;
+        count_++;
+        return true;
+    }
+
+    size_t load() const { return count_; }
+
+private:
+    size_t count_;
+};
+
+// counts and whatever it takes to get rid of the object, shared by all
+// copies of a pointer. The users together hold one weak reference, so the
+// block goes away with the last weak reference after the object has gone
+// with the last user.
+template<typename RefCount>
+class SharedControlBlock
+{
+public:
+    SharedControlBlock()
+    : users_(1)
+    , weak_(1)
+    {
+    }
+    virtual ~SharedControlBlock() = default;
+
+    void addUser() { users_.increment(); }
+    bool tryAddUser() { return users_.incrementIfNonZero(); }
+
+    // true if that was the last user, the caller then calls destroyObject()
+    // and releaseWeak()
+    bool release() { return users_.decrement(); }
+
+    void addWeak() { weak_.increment(); }
+
+    void releaseWeak()
+    {
+        if (weak_.decrement()) deallocate();
+    }
+
+    size_t users() const { return users_.load(); }
+
+    virtual void destroyObject() = 0;
+
+protected:
+    // frees the block, however it was allocated
+    virtual void deallocate() = 0;
+
+private:
+    RefCount users_;
+    RefCount weak_;
+};
+
+// the object lives inside the block: one allocation for both, from
+// Allocator (see slab_allocator.h)
+template<typename T, typename RefCount, typename Allocator = HeapAllocator>
+class InlineControlBlock : public SharedControlBlock<RefCount>
+{
+public:
+    template<typename ...Args>
+    static InlineControlBlock* create(Args&&... args)
+    {
+        void* p = Allocator::allocate(sizeof(InlineControlBlock), alignof(InlineControlBlock));
+        try
+        {
+            return new (p) InlineControlBlock(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            Allocator::deallocate(p, sizeof(InlineControlBlock), alignof(InlineControlBlock));
+            throw;
+        }
+    }
+
+    // object_ is destroyed by destroyObject(), maybe well before this
+    ~InlineControlBlock() override {}
+
+    T* get() { return &object_; }
+
+    void destroyObject() override
+    {
+        SharedPtrTrace::destroyed(&object_);
+        object_.~T();
+    }
+
+protected:
+    void deallocate() override
+    {
+        this->~InlineControlBlock();
+        Allocator::deallocate(this, sizeof(InlineControlBlock), alignof(InlineControlBlock));
+    }
+
+private:
+    template<typename ...Args>
+    explicit InlineControlBlock(Args&&... args)
+    {
+        new (&object_) T(std::forward<Args>(args)...);
+        SharedPtrTrace::created(&object_);
+    }
+
+    union
+    {
+        T object_;
+    };
+};
+
+/*
+ * Base for objects that carry their own count. IntrusivePtr<T> of such a T
+ * (anything with these three members) is a single T*: no control block,
+ * the count sits on the object's own cache line, and a new reference can
+ * be made from a plain pointer to it, this included.
+ */
+template<typename RefCount = AtomicRefCount>
+class RefCounted
+{
+public:
+    void addRef() const { refs_.increment(); }
+    // true for the last reference, the caller deletes the object
+    bool releaseRef() const { return refs_.decrement(); }
+    size_t refCount() const { return refs_.load(); }
+
+protected:
+    RefCounted()
+    : refs_(0)
+    {
+    }
+
+    // a copy is a new object, nobody refers to it yet
+    RefCounted(const RefCounted&)
+    : refs_(0)
+    {
+    }
+
+    RefCounted& operator=(const RefCounted&) { return *this; }
+    ~RefCounted() = default;
+
+private:
+    mutable RefCount refs_;
+};
+
+template<typename T, typename RefCount>
+class MyWeakPtr;
+
+template<typename T, typename RefCount>
+class AtomicSharedPtr;
 
 // heap-alocated MySharedPtr object
-template<typename T>
+//
+// Copies share the object, moves hand it over without touching the count
+// and leave the source empty. An empty pointer (moved from, or made from
+// nullptr) has no object and a count of 0.
+template<typename T, typename RefCount = AtomicRefCount>
 class MySharedPtr
 {
+    using Block = SharedControlBlock<RefCount>;
+
 public:
+    // constructs the object in place, in the same allocation as the count
     template<typename ...Args>
-    MySharedPtr(Args... args)
-    : users_(new size_t)
+        requires std::is_constructible_v<T, Args...>
+                 && (!std::is_same_v<std::remove_cvref_t<Args>, MySharedPtr> && ...)
+                 && (!std::is_same_v<std::remove_cvref_t<Args>, std::allocator_arg_t> && ...)
+    MySharedPtr(Args&&... args)
+    : MySharedPtr(std::allocator_arg, HeapAllocator(), std::forward<Args>(args)...)
+    {
+    }
+
+    // same, with that allocation from Allocator, e.g.
+    // MySharedPtr<Foo>(std::allocator_arg, SlabAllocator(), args...)
+    template<typename Allocator, typename ...Args>
+        requires std::is_constructible_v<T, Args...>
+    MySharedPtr(std::allocator_arg_t, Allocator, Args&&... args)
+    {
+        auto* block = InlineControlBlock<T, RefCount, Allocator>::create(std::forward<Args>(args)...);
+        ptr_ = block->get();
+        block_ = block;
+    }
+
+    MySharedPtr(std::nullptr_t)
+    : ptr_(nullptr)
+    , block_(nullptr)
     {
-        ptr_ = new T(std::forward<Args>(args)...);
-        *users_ = 1;
     }
 
-    MySharedPtr(MySharedPtr<T>& other)
+    MySharedPtr(const MySharedPtr& other)
     {
-        copy(other);
+        copy(other.ptr_, other.block_);
     }
 
-    MySharedPtr(MySharedPtr<T>&& other)
+    MySharedPtr(MySharedPtr&& other) noexcept
+    : ptr_(std::exchange(other.ptr_, nullptr))
+    , block_(std::exchange(other.block_, nullptr))
     {
-        copy(other);
+    }
+
+    // aliasing: shares owner's object (keeps it alive) but points at ptr,
+    // typically a member of it
+    template<typename U>
+    MySharedPtr(const MySharedPtr<U, RefCount>& owner, T* ptr)
+    {
+        copy(ptr, owner.block_);
+    }
+
+    template<typename U>
+    MySharedPtr(MySharedPtr<U, RefCount>&& owner, T* ptr) noexcept
+    : ptr_(ptr)
+    , block_(std::exchange(owner.block_, nullptr))
+    {
+        owner.ptr_ = nullptr;
     }
 
     ~MySharedPtr()
     {
-        (*users_)--;
+        release();
+    }
+
+    // copy first, drop the old object last: other may live inside it
+    // (head = head->next)
+    MySharedPtr& operator=(const MySharedPtr& other)
+    {
+        MySharedPtr(other).swap(*this);
+        return *this;
+    }
+
+    // same for moves (head = std::move(head->next))
+    MySharedPtr& operator=(MySharedPtr&& other) noexcept
+    {
+        MySharedPtr(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    T& operator*() const
+    {
+        return *ptr_;
+    }
+
+    T* operator->() const { return ptr_; }
+    T* get() const { return ptr_; }
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+    size_t getCount() const { return block_ ? block_->users() : 0; }
+
+    // empty first, then drop: this may live inside the object
+    void reset()
+    {
+        MySharedPtr(nullptr).swap(*this);
+    }
+
+    void swap(MySharedPtr& other) noexcept
+    {
+        std::swap(ptr_, other.ptr_);
+        std::swap(block_, other.block_);
+    }
+
+private:
+    template<typename, typename>
+    friend class MySharedPtr;
+    friend class MyWeakPtr<T, RefCount>;
+    template<typename, typename>
+    friend class AtomicSharedPtr;
+
+    struct Adopt
+    {
+    };
 
+    // takes over a user reference the caller already holds
+    MySharedPtr(Adopt, T* ptr, Block* block)
+    : ptr_(ptr)
+    , block_(block)
+    {
+    }
+
+    void copy(T* ptr, Block* block)
+    {
+        ptr_ = ptr;
+        block_ = block;
+
+        if (block_) block_->addUser();
+    }
+
+    void release()
+    {
         // no more users of object left
-        if ((*users_) == 0)
+        if (block_ && block_->release())
         {
-            std::cout << "RELEASING MEMORY" << std::endl;
-            delete ptr_;
-            delete users_;
+            block_->destroyObject();
+            block_->releaseWeak();
         }
     }
 
-    MySharedPtr& operator=(MySharedPtr& other)
+    T* ptr_;
+    Block* block_;
+};
+
+// shared pointer for a T that keeps the count itself (see RefCounted), the
+// pointer is just a T*. A type of its own rather than picked by looking
+// at T, which may still be incomplete where the pointer is declared
+// (IntrusivePtr<Node> next inside Node). No weak or aliasing pointers,
+// there is no block to keep alive.
+template<typename T>
+class IntrusivePtr
+{
+public:
+    template<typename ...Args>
+        requires std::is_constructible_v<T, Args...>
+                 && (!std::is_same_v<std::remove_cvref_t<Args>, IntrusivePtr> && ...)
+    IntrusivePtr(Args&&... args)
+    : IntrusivePtr(new T(std::forward<Args>(args)...))
+    {
+    }
+
+    // takes a reference to object, new or already shared
+    explicit IntrusivePtr(T* object)
+    : ptr_(object)
+    {
+        if (!ptr_) return;
+        ptr_->addRef();
+        // first owner, it's a shared object from now on
+        if (ptr_->refCount() == 1) SharedPtrTrace::created(ptr_);
+    }
+
+    IntrusivePtr(std::nullptr_t)
+    : ptr_(nullptr)
     {
-        copy(other);
+    }
+
+    IntrusivePtr(const IntrusivePtr& other)
+    : IntrusivePtr(other.ptr_)
+    {
+    }
+
+    IntrusivePtr(IntrusivePtr&& other) noexcept
+    : ptr_(std::exchange(other.ptr_, nullptr))
+    {
+    }
+
+    ~IntrusivePtr()
+    {
+        release();
+    }
+
+    // as above: other may live inside the object being dropped
+    IntrusivePtr& operator=(const IntrusivePtr& other)
+    {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept
+    {
+        IntrusivePtr(std::move(other)).swap(*this);
         return *this;
     }
 
@@ -51,17 +426,130 @@ public:
         return *ptr_;
     }
 
-    void copy(MySharedPtr<T>& other)
+    T* operator->() const { return ptr_; }
+    T* get() const { return ptr_; }
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+    size_t getCount() const { return ptr_ ? ptr_->refCount() : 0; }
+
+    void reset()
     {
-        ptr_ = other.ptr_;
-        users_ = other.users_;
+        IntrusivePtr(nullptr).swap(*this);
+    }
+
+    void swap(IntrusivePtr& other) noexcept { std::swap(ptr_, other.ptr_); }
 
-        (*users_)++;
+private:
+    void release()
+    {
+        // no more users of object left
+        if (ptr_ && ptr_->releaseRef())
+        {
+            SharedPtrTrace::destroyed(ptr_);
+            delete ptr_;
+        }
+    }
+
+    T* ptr_;
+};
+
+// non-owning reference to a MySharedPtr's object: doesn't keep it alive,
+// but can tell whether it still is and lock() it into a MySharedPtr if so
+template<typename T, typename RefCount = AtomicRefCount>
+class MyWeakPtr
+{
+    using Block = SharedControlBlock<RefCount>;
+
+public:
+    MyWeakPtr()
+    : ptr_(nullptr)
+    , block_(nullptr)
+    {
+    }
+
+    MyWeakPtr(const MySharedPtr<T, RefCount>& shared)
+    {
+        copy(shared.ptr_, shared.block_);
+    }
+
+    MyWeakPtr(const MyWeakPtr& other)
+    {
+        copy(other.ptr_, other.block_);
+    }
+
+    MyWeakPtr(MyWeakPtr&& other) noexcept
+    : ptr_(std::exchange(other.ptr_, nullptr))
+    , block_(std::exchange(other.block_, nullptr))
+    {
+    }
+
+    ~MyWeakPtr()
+    {
+        release();
+    }
+
+    MyWeakPtr& operator=(const MyWeakPtr& other)
+    {
+        if (this != &other)
+        {
+            release();
+            copy(other.ptr_, other.block_);
+        }
+        return *this;
+    }
+
+    MyWeakPtr& operator=(MyWeakPtr&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            ptr_ = std::exchange(other.ptr_, nullptr);
+            block_ = std::exchange(other.block_, nullptr);
+        }
+        return *this;
+    }
+
+    // empty if the object is gone already
+    MySharedPtr<T, RefCount> lock() const
+    {
+        if (!block_ || !block_->tryAddUser()) return nullptr;
+        return MySharedPtr<T, RefCount>(typename MySharedPtr<T, RefCount>::Adopt{}, ptr_, block_);
     }
 
-    size_t getCount() { return *users_; }
+    bool expired() const { return getCount() == 0; }
+    size_t getCount() const { return block_ ? block_->users() : 0; }
 
 private:
+    void copy(T* ptr, Block* block)
+    {
+        ptr_ = ptr;
+        block_ = block;
+
+        if (block_) block_->addWeak();
+    }
+
+    void release()
+    {
+        if (block_) block_->releaseWeak();
+    }
+
     T* ptr_;
-    size_t* users_;
-};
\ No newline at end of file
+    Block* block_;
+};
+
+// single-threaded flavour, plain increments
+template<typename T>
+using LocalSharedPtr = MySharedPtr<T, PlainRefCount>;
+
+template<typename T, typename RefCount = AtomicRefCount, typename ...Args>
+MySharedPtr<T, RefCount> makeShared(Args&&... args)
+{
+    return MySharedPtr<T, RefCount>(std::forward<Args>(args)...);
+}
+
+// allocateShared<Foo, SlabAllocator>(args...)
+template<typename T, typename Allocator, typename RefCount = AtomicRefCount, typename ...Args>
+MySharedPtr<T, RefCount> allocateShared(Args&&... args)
+{
+    return MySharedPtr<T, RefCount>(std::allocator_arg, Allocator(), std::forward<Args>(args)...);
+}
@@ -0,0 +1,106 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "pool_coroutine.h"
+
+/*
+ * NUM_HANDLERS "requests" that each wait on two 20ms timers (think of them
+ * as I/O) on a pool of 4 threads. Each wait suspends the coroutine rather
+ * than blocking a worker, so the whole batch takes roughly 40ms, not
+ * NUM_HANDLERS * 40ms / 4.
+ */
+
+#define NUM_HANDLERS 10000
+
+using namespace std::chrono_literals;
+
+int lookup(int id)
+{
+    return id * 2;
+}
+
+CoTask<int> fetch(ThreadPool& pool, int id)
+{
+    co_await pool.scheduleAfter(20ms);
+    co_return id;
+}
+
+CoTask<int> handler(ThreadPool& pool, int id)
+{
+    co_await pool.schedule();
+    int fetched = co_await fetch(pool, id);
+    co_await pool.scheduleAfter(20ms);
+    int looked = co_await poolAsync(pool, lookup, fetched);
+    co_return looked - id;
+}
+
+CoTask<void> sleepy(ThreadPool& pool)
+{
+    co_await pool.scheduleAfter(1h);
+}
+
+// shutdown() doesn't wait an hour: the coroutine still waiting on its timer
+// gets a broken_promise instead
+bool shutdownCancelsTimers()
+{
+    ThreadPool pool(2);
+    PoolFuture<void> res = launch(pool, sleepy(pool));
+    std::this_thread::sleep_for(20ms);
+    pool.shutdown();
+    try
+    {
+        res.get();
+    }
+    catch (const std::future_error& e)
+    {
+        return e.code() == std::future_errc::broken_promise;
+    }
+    return false;
+}
+
+// same as enqueue(): a shut down pool throws right away
+bool launchAfterShutdownThrows()
+{
+    ThreadPool pool(1);
+    pool.shutdown();
+    try
+    {
+        launch(pool, sleepy(pool));
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    ThreadPool pool(4);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PoolFuture<int>> results;
+    for (int i = 0; i < NUM_HANDLERS; i++)
+    {
+        results.push_back(launch(pool, handler(pool, i)));
+    }
+
+    long long sum = 0;
+    for (PoolFuture<int>& res : results)
+    {
+        sum += res.get();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    long long expected = (long long)NUM_HANDLERS * (NUM_HANDLERS - 1) / 2;
+    std::cout << std::boolalpha << "SUM:" << sum << " " << (sum == expected) << std::endl;
+    std::cout << "HANDLERS:" << NUM_HANDLERS << " TIME(ms):" << elapsed.count() << std::endl;
+
+    std::cout << "SHUTDOWN CANCELS TIMERS:" << shutdownCancelsTimers() << std::endl;
+    std::cout << "LAUNCH AFTER SHUTDOWN THROWS:" << launchAfterShutdownThrows() << std::endl;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "pool_future.h"
+#include "threadpool.h"
+
+/*
+ * C++20 coroutines on top of ThreadPool.
+ *
+ *   CoTask<int> handler(ThreadPool& pool)
+ *   {
+ *       co_await pool.schedule();          // hop onto a worker
+ *       co_await pool.scheduleAfter(5ms);  // timer, no worker is blocked
+ *       int x = co_await otherTask(pool);  // runs otherTask, resumes when done
+ *       co_return x + co_await poolAsync(pool, compute);  // PoolFutures too
+ *   }
+ *
+ *   PoolFuture<int> res = launch(pool, handler(pool));
+ *
+ * CoTask is lazy: it doesn't run until it's co_awaited (or launch()ed), and
+ * the awaiting coroutine resumes directly on the thread that finished it.
+ */
+
+template<typename T>
+class CoTask;
+
+template<typename T>
+struct CoTaskPromiseBase
+{
+    // resume whoever co_awaited us, without growing the stack
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { error_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr error_;
+};
+
+template<typename T>
+struct CoTaskPromise : CoTaskPromiseBase<T>
+{
+    CoTask<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+    T result()
+    {
+        if (this->error_) std::rethrow_exception(this->error_);
+        return std::move(*value_);
+    }
+
+    std::optional<T> value_;
+};
+
+template<>
+struct CoTaskPromise<void> : CoTaskPromiseBase<void>
+{
+    CoTask<void> get_return_object();
+
+    void return_void() {}
+
+    void result()
+    {
+        if (error_) std::rethrow_exception(error_);
+    }
+};
+
+template<typename T>
+class CoTask
+{
+public:
+    using promise_type = CoTaskPromise<T>;
+
+    explicit CoTask(std::coroutine_handle<promise_type> handle)
+    : handle_(handle)
+    {
+    }
+
+    CoTask(CoTask& other) = delete;
+    CoTask& operator=(CoTask& other) = delete;
+
+    CoTask(CoTask&& other) noexcept
+    : handle_(std::exchange(other.handle_, nullptr))
+    {
+    }
+
+    CoTask& operator=(CoTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~CoTask()
+    {
+        if (handle_) handle_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    // start the task, we get resumed from its final_suspend
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation_ = awaiting;
+        return handle_;
+    }
+
+    T await_resume() { return handle_.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template<typename T>
+CoTask<T> CoTaskPromise<T>::get_return_object()
+{
+    return CoTask<T>(std::coroutine_handle<CoTaskPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoTaskPromise<void>::get_return_object()
+{
+    return CoTask<void>(std::coroutine_handle<CoTaskPromise<void>>::from_promise(*this));
+}
+
+// co_await on a PoolFuture suspends until it's ready and resumes on the
+// future's pool, so no worker sits blocked in get()
+template<typename T>
+auto operator co_await(PoolFuture<T> future)
+{
+    struct Awaiter
+    {
+        PoolFuture<T> future;
+
+        bool await_ready() const { return future.isReady(); }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            ThreadPool* pool = &future.pool();
+            future.onReady([pool, handle]()
+            {
+                try
+                {
+                    pool->enqueue_detached([handle]() { handle.resume(); });
+                    return;
+                }
+                catch (const std::runtime_error&)
+                {
+                    // shut down, maybe that's what broke the promise:
+                    // resume right here rather than leak the coroutine
+                }
+                handle.resume();
+            });
+        }
+
+        decltype(auto) await_resume() const
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                future.get();
+            }
+            else
+            {
+                return T(future.get());
+            }
+        }
+    };
+    return Awaiter{ std::move(future) };
+}
+
+// fire-and-forget coroutine, cleans up its own frame when it finishes
+struct DetachedCoroutine
+{
+    struct promise_type
+    {
+        DetachedCoroutine get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+// runs task on pool's workers, the result (or exception) lands in the
+// returned future. Throws like enqueue() if the pool is shut down.
+template<typename T>
+PoolFuture<T> launch(ThreadPool& pool, CoTask<T> task)
+{
+    if (!pool.accepting()) throw std::runtime_error("ThreadPool is shut down");
+
+    PoolPromise<T> promise(pool);
+    PoolFuture<T> fut = promise.getFuture();
+
+    [](ThreadPool& pool, CoTask<T> task, PoolPromise<T> promise) -> DetachedCoroutine
+    {
+        // schedule() inside the try: the pool may have been shut down since
+        // the check above, and an exception leaving a DetachedCoroutine
+        // terminates
+        std::exception_ptr error;
+        if constexpr (std::is_void_v<T>)
+        {
+            try
+            {
+                co_await pool.schedule();
+                co_await std::move(task);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            if (!error) promise.setValue();
+        }
+        else
+        {
+            std::optional<T> value;
+            try
+            {
+                co_await pool.schedule();
+                value.emplace(co_await std::move(task));
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            if (!error) promise.setValue(std::move(*value));
+        }
+        if (error) promise.setException(error);
+    }(pool, std::move(task), promise);
+
+    return fut;
+}
@@ -0,0 +1,537 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "inline_task.h"
+#include "threadpool.h"
+
+/*
+ * Futures that know which ThreadPool they belong to, so follow-up work can
+ * be chained with then() / when_all() / when_any() and gets scheduled on the
+ * pool the moment its inputs are ready, instead of parking a thread in get().
+ *
+ * Unlike std::future a PoolFuture is copyable (like std::shared_future) and
+ * get() can be called any number of times.
+ */
+
+template<typename T>
+class PoolFuture;
+
+// what then(func) produces: func(const T&), or func() for void
+template<typename T, typename F>
+struct ThenResult
+{
+    using type = std::invoke_result_t<F&, const T&>;
+};
+
+template<typename F>
+struct ThenResult<void, F>
+{
+    using type = std::invoke_result_t<F&>;
+};
+
+template<typename T>
+class FutureState
+{
+public:
+    using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    FutureState(ThreadPool& pool)
+    : pool_(pool)
+    , ready_(false)
+    , promises_(0)
+    {
+    }
+
+    template<typename ...V>
+    void setValue(V&& ...value)
+    {
+        value_.emplace(std::forward<V>(value)...);
+        complete();
+    }
+
+    void setException(std::exception_ptr error)
+    {
+        error_ = error;
+        complete();
+    }
+
+    // callbacks run inline on whichever thread completes the state (or right
+    // away if it already is), so they should be cheap or hand off to the pool
+    void onReady(InlineTask callback)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (!ready_)
+            {
+                callbacks_.push_back(std::move(callback));
+                return;
+            }
+        }
+        callback();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [&]() { return ready_; });
+    }
+
+    bool isReady()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return ready_;
+    }
+
+    ThreadPool& pool() { return pool_; }
+
+    // PoolPromise copies alive; when the last one goes away without setting
+    // a result (e.g. its task was discarded by ThreadPool::shutdown) the
+    // future gets a broken_promise instead of waiting forever
+    void addPromise() { promises_.fetch_add(1, std::memory_order_relaxed); }
+
+    void dropPromise()
+    {
+        if (promises_.fetch_sub(1, std::memory_order_acq_rel) == 1 && !isReady())
+        {
+            setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    // only valid once ready, never modified after that
+    const Value& value() const { return *value_; }
+    std::exception_ptr error() const { return error_; }
+
+private:
+    void complete()
+    {
+        std::vector<InlineTask> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (ready_) throw std::logic_error("PoolFuture result was already set");
+            ready_ = true;
+            callbacks.swap(callbacks_);
+        }
+        cv_.notify_all();
+        for (InlineTask& callback : callbacks)
+        {
+            callback();
+        }
+    }
+
+    ThreadPool& pool_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool ready_;
+    std::atomic<size_t> promises_;
+    std::optional<Value> value_;
+    std::exception_ptr error_;
+    std::vector<InlineTask> callbacks_;
+};
+
+template<typename T>
+class PoolPromise
+{
+public:
+    PoolPromise(ThreadPool& pool)
+    : state_(std::allocate_shared<FutureState<T>>(SlabStdAllocator<FutureState<T>>(), pool))
+    {
+        state_->addPromise();
+    }
+
+    PoolPromise(const PoolPromise& other)
+    : state_(other.state_)
+    {
+        state_->addPromise();
+    }
+
+    PoolPromise(PoolPromise&& other) noexcept
+    : state_(std::move(other.state_))
+    {
+    }
+
+    PoolPromise& operator=(const PoolPromise& other) = delete;
+    PoolPromise& operator=(PoolPromise&& other) = delete;
+
+    ~PoolPromise()
+    {
+        if (state_) state_->dropPromise();
+    }
+
+    PoolFuture<T> getFuture() const { return PoolFuture<T>(state_); }
+
+    template<typename ...V>
+    void setValue(V&& ...value) const { state_->setValue(std::forward<V>(value)...); }
+
+    void setException(std::exception_ptr error) const { state_->setException(error); }
+
+    // runs func and stores whatever it returned or threw
+    template<typename F>
+    void fulfil(F&& func) const
+    {
+        if constexpr (std::is_void_v<T>)
+        {
+            try
+            {
+                func();
+            }
+            catch (...)
+            {
+                setException(std::current_exception());
+                return;
+            }
+            setValue();
+        }
+        else
+        {
+            std::optional<T> result;
+            try
+            {
+                result.emplace(func());
+            }
+            catch (...)
+            {
+                setException(std::current_exception());
+                return;
+            }
+            setValue(std::move(*result));
+        }
+    }
+
+private:
+    std::shared_ptr<FutureState<T>> state_;
+};
+
+template<typename T>
+class PoolFuture
+{
+public:
+    PoolFuture() = default;
+
+    explicit PoolFuture(std::shared_ptr<FutureState<T>> state)
+    : state_(std::move(state))
+    {
+    }
+
+    bool valid() const { return state_ != nullptr; }
+    bool isReady() const { return state_->isReady(); }
+    void wait() const { state_->wait(); }
+
+    // blocks, so prefer then() from inside the pool's own tasks
+    std::add_lvalue_reference_t<const T> get() const
+    {
+        state_->wait();
+        if (state_->error()) std::rethrow_exception(state_->error());
+        if constexpr (!std::is_void_v<T>)
+        {
+            return state_->value();
+        }
+    }
+
+    // only valid once ready
+    bool hasException() const { return state_->error() != nullptr; }
+
+    // see FutureState::onReady
+    void onReady(InlineTask callback) const { state_->onReady(std::move(callback)); }
+
+    ThreadPool& pool() const { return state_->pool(); }
+
+    // schedules func(value) (or func() for PoolFuture<void>) on the pool
+    // once this future is ready. An exception in this future skips func and
+    // is passed straight on to the returned future; a pool that has been
+    // shut down by then gives it a broken_promise.
+    template<typename F>
+    auto then(F&& func) const
+    {
+        using R = typename ThenResult<T, std::decay_t<F>>::type;
+
+        PoolPromise<R> promise(state_->pool());
+        PoolFuture<R> next = promise.getFuture();
+        std::shared_ptr<FutureState<T>> input = state_;
+
+        input->onReady([input, promise, func = std::forward<F>(func)]() mutable
+        {
+            // passed on right here: the error may be a broken promise from
+            // a pool that's shutting down and won't take the hop any more
+            if (input->error())
+            {
+                promise.setException(input->error());
+                return;
+            }
+
+            try
+            {
+                input->pool().enqueue_detached([input, promise, func = std::move(func)]() mutable
+                {
+                    promise.fulfil([&]()
+                    {
+                        if constexpr (std::is_void_v<T>)
+                        {
+                            return func();
+                        }
+                        else
+                        {
+                            return func(input->value());
+                        }
+                    });
+                });
+            }
+            catch (const std::runtime_error&)
+            {
+                // shut down, the task was dropped along with its copy of
+                // promise and ours breaks it when this callback goes away
+            }
+        });
+        return next;
+    }
+
+private:
+    std::shared_ptr<FutureState<T>> state_;
+};
+
+// like pool.enqueue(), but returns a PoolFuture
+template<typename F, typename ...Args>
+auto poolAsync(ThreadPool& pool, F&& func, Args&& ...args)
+{
+    using R = std::invoke_result_t<std::decay_t<F>&, std::decay_t<Args>&...>;
+
+    PoolPromise<R> promise(pool);
+    PoolFuture<R> fut = promise.getFuture();
+    pool.enqueue_detached([promise, func = std::forward<F>(func), ...args = std::forward<Args>(args)]() mutable
+    {
+        promise.fulfil([&]() { return func(args...); });
+    });
+    return fut;
+}
+
+// ready once every input is. Gives the values in input order
+// (PoolFuture<void> when T is void), or the first exception any input had.
+template<typename T>
+auto when_all(std::vector<PoolFuture<T>> futures)
+{
+    using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+    if (futures.empty()) throw std::invalid_argument("when_all needs at least one future");
+
+    struct Gather
+    {
+        Gather(std::vector<PoolFuture<T>> inputs)
+        : promise(inputs.front().pool())
+        , inputs(std::move(inputs))
+        , remaining(this->inputs.size())
+        , failed(false)
+        {
+        }
+
+        PoolPromise<R> promise;
+        std::vector<PoolFuture<T>> inputs;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+    };
+
+    std::shared_ptr<Gather> gather = std::make_shared<Gather>(std::move(futures));
+    PoolFuture<R> result = gather->promise.getFuture();
+
+    for (size_t i = 0; i < gather->inputs.size(); i++)
+    {
+        gather->inputs[i].onReady([gather, i]()
+        {
+            const PoolFuture<T>& input = gather->inputs[i];
+            if (input.hasException() && !gather->failed.exchange(true))
+            {
+                try { input.get(); } catch (...) { gather->promise.setException(std::current_exception()); }
+            }
+
+            if (gather->remaining.fetch_sub(1) != 1 || gather->failed.load()) return;
+
+            if constexpr (std::is_void_v<T>)
+            {
+                gather->promise.setValue();
+            }
+            else
+            {
+                std::vector<T> values;
+                values.reserve(gather->inputs.size());
+                for (const PoolFuture<T>& in : gather->inputs)
+                {
+                    values.push_back(in.get());
+                }
+                gather->promise.setValue(std::move(values));
+            }
+        });
+    }
+    return result;
+}
+
+// ready as soon as any input is (value or exception), gives its index
+template<typename T>
+PoolFuture<size_t> when_any(std::vector<PoolFuture<T>> futures)
+{
+    if (futures.empty()) throw std::invalid_argument("when_any needs at least one future");
+
+    PoolPromise<size_t> promise(futures.front().pool());
+    std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        futures[i].onReady([promise, done, i]()
+        {
+            if (!done->exchange(true)) promise.setValue(i);
+        });
+    }
+    return promise.getFuture();
+}
+
+/*
+ * Static DAG of tasks. Nodes are scheduled on the pool as soon as the last
+ * node they depend on has finished, so no thread ever blocks waiting for a
+ * dependency. If a node throws, nodes that haven't started yet are skipped
+ * and the exception comes out of the future returned by run().
+ *
+ * The graph must outlive the run and can't be modified or run again until
+ * the previous run has completed.
+ */
+class TaskGraph
+{
+public:
+    using Node = size_t;
+
+    template<typename F>
+    Node addNode(F&& func)
+    {
+        nodes_.push_back(NodeData{ InlineTask(std::forward<F>(func)), {}, 0 });
+        return nodes_.size() - 1;
+    }
+
+    // before has to finish before after may start
+    void addEdge(Node before, Node after)
+    {
+        if (before >= nodes_.size() || after >= nodes_.size()) throw std::out_of_range("TaskGraph node does not exist");
+        nodes_[before].successors.push_back(after);
+        nodes_[after].dependencies++;
+    }
+
+    PoolFuture<void> run(ThreadPool& pool)
+    {
+        checkAcyclic();
+
+        std::shared_ptr<Run> run = std::make_shared<Run>(pool, nodes_.size());
+        PoolFuture<void> fut = run->promise.getFuture();
+        if (nodes_.empty())
+        {
+            run->promise.setValue();
+            return fut;
+        }
+
+        for (size_t i = 0; i < nodes_.size(); i++)
+        {
+            run->remaining[i].store(nodes_[i].dependencies, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < nodes_.size(); i++)
+        {
+            if (nodes_[i].dependencies == 0) schedule(run, i);
+        }
+        return fut;
+    }
+
+private:
+    struct NodeData
+    {
+        InlineTask func;
+        std::vector<Node> successors;
+        size_t dependencies;
+    };
+
+    struct Run
+    {
+        Run(ThreadPool& pool, size_t numNodes)
+        : pool(pool)
+        , promise(pool)
+        , remaining(new std::atomic<size_t>[numNodes])
+        , finished(0)
+        , failed(false)
+        {
+        }
+
+        ThreadPool& pool;
+        PoolPromise<void> promise;
+        std::unique_ptr<std::atomic<size_t>[]> remaining;
+        std::atomic<size_t> finished;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+    };
+
+    void schedule(std::shared_ptr<Run> run, Node node)
+    {
+        run->pool.enqueue_detached([this, run, node]()
+        {
+            if (!run->failed.load())
+            {
+                try
+                {
+                    nodes_[node].func();
+                }
+                catch (...)
+                {
+                    if (!run->failed.exchange(true)) run->error = std::current_exception();
+                }
+            }
+
+            for (Node next : nodes_[node].successors)
+            {
+                if (run->remaining[next].fetch_sub(1) == 1) schedule(run, next);
+            }
+
+            if (run->finished.fetch_add(1) + 1 == nodes_.size())
+            {
+                if (run->failed.load())
+                {
+                    run->promise.setException(run->error);
+                }
+                else
+                {
+                    run->promise.setValue();
+                }
+            }
+        });
+    }
+
+    // Kahn's algorithm, a cycle would leave nodes that never get scheduled
+    void checkAcyclic() const
+    {
+        std::vector<size_t> indegree(nodes_.size());
+        std::vector<Node> ready;
+        for (size_t i = 0; i < nodes_.size(); i++)
+        {
+            indegree[i] = nodes_[i].dependencies;
+            if (indegree[i] == 0) ready.push_back(i);
+        }
+
+        size_t visited = 0;
+        while (!ready.empty())
+        {
+            Node node = ready.back();
+            ready.pop_back();
+            visited++;
+            for (Node next : nodes_[node].successors)
+            {
+                if (--indegree[next] == 0) ready.push_back(next);
+            }
+        }
+
+        if (visited != nodes_.size()) throw std::invalid_argument("TaskGraph has a cycle");
+    }
+
+    std::vector<NodeData> nodes_;
+};
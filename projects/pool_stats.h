@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cycle_clock.h"
+
+/*
+ * ThreadPool instrumentation: per-worker counters and wait / run time
+ * histograms, merged when someone asks for a PoolStats snapshot.
+ *
+ * Off unless compiled with -DTHREADPOOL_STATS=1. When off every hook is an
+ * empty inline function and TaskStamp is an empty struct, so neither the
+ * per-task work nor the queued task size changes.
+ *
+ * When on, a task costs two or three cycle counter reads and a handful of
+ * relaxed increments on cache lines owned by the worker that ran it.
+ */
+
+#ifndef THREADPOOL_STATS
+#define THREADPOOL_STATS 0
+#endif
+
+inline constexpr bool POOL_STATS_ENABLED = THREADPOOL_STATS;
+
+// when a task was queued, nothing at all with stats compiled out
+struct TaskStamp
+{
+#if THREADPOOL_STATS
+    uint64_t ticks = 0;
+
+    static TaskStamp now() { return TaskStamp{ CycleClock::now() }; }
+    uint64_t nanosUntil(uint64_t later) const { return CycleClock::toNanos(later - ticks); }
+#else
+    static TaskStamp now() { return TaskStamp{}; }
+    uint64_t nanosUntil(uint64_t) const { return 0; }
+#endif
+};
+
+// plain counts of a LatencyHistogram, mergeable and queryable
+struct HistogramSnapshot
+{
+    // log-linear buckets like HdrHistogram: SUB_BUCKETS per power of two,
+    // so any value is off by at most 1 / SUB_BUCKETS (12.5%)
+    static constexpr int SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::array<uint64_t, NUM_BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    static size_t bucketOf(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) return size_t(value);
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return size_t(shift + 1) * SUB_BUCKETS + size_t((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // smallest value that lands in bucket
+    static uint64_t lowerBound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS) return bucket;
+        int shift = int(bucket / SUB_BUCKETS) - 1;
+        return (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    }
+
+    void merge(const HistogramSnapshot& other)
+    {
+        for (size_t i = 0; i < NUM_BUCKETS; i++) counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    uint64_t mean() const { return total ? sum / total : 0; }
+
+    // p in [0, 100]
+    uint64_t percentile(double p) const
+    {
+        if (total == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(double(total) * p / 100.0 + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NUM_BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank) return std::min(lowerBound(i), max);
+        }
+        return max;
+    }
+};
+
+// written by one worker only, read by anyone, so relaxed load + store
+// instead of fetch_add (no locked instruction on the hot path)
+class LatencyHistogram
+{
+public:
+    void record(uint64_t value)
+    {
+        bump(counts_[HistogramSnapshot::bucketOf(value)], 1);
+        bump(total_, 1);
+        bump(sum_, value);
+        if (value > max_.load(std::memory_order_relaxed)) max_.store(value, std::memory_order_relaxed);
+    }
+
+    void addTo(HistogramSnapshot& out) const
+    {
+        HistogramSnapshot mine;
+        for (size_t i = 0; i < HistogramSnapshot::NUM_BUCKETS; i++) mine.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        mine.total = total_.load(std::memory_order_relaxed);
+        mine.sum = sum_.load(std::memory_order_relaxed);
+        mine.max = max_.load(std::memory_order_relaxed);
+        out.merge(mine);
+    }
+
+    // only while nobody is recording
+    void reset()
+    {
+        for (std::atomic<uint64_t>& count : counts_) count.store(0, std::memory_order_relaxed);
+        total_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, HistogramSnapshot::NUM_BUCKETS> counts_{};
+    std::atomic<uint64_t> total_{ 0 };
+    std::atomic<uint64_t> sum_{ 0 };
+    std::atomic<uint64_t> max_{ 0 };
+};
+
+// one per worker, on its own cache lines
+struct alignas(64) WorkerStats
+{
+    WorkerStats()
+    : started(CycleClock::now())
+    {
+    }
+
+    // the owning worker is the only writer
+    void taskDone(uint64_t waitNs, uint64_t runTicks)
+    {
+        wait.record(waitNs);
+        run.record(CycleClock::toNanos(runTicks));
+        busyTicks.store(busyTicks.load(std::memory_order_relaxed) + runTicks, std::memory_order_relaxed);
+    }
+
+    // hands the slot of a retired worker to a new one, after the caller
+    // folded the histograms into its RetiredStats
+    void reuse()
+    {
+        wait.reset();
+        run.reset();
+        busyTicks.store(0, std::memory_order_relaxed);
+        started = CycleClock::now();
+        retired.store(false);
+    }
+
+    uint64_t started;
+    std::atomic<uint64_t> busyTicks{ 0 };
+    std::atomic<bool> retired{ false };
+    LatencyHistogram wait; // ns from enqueue until a worker picked it up
+    LatencyHistogram run;  // ns spent in the task itself
+};
+
+// what the workers whose slots got reused had recorded
+struct RetiredStats
+{
+    HistogramSnapshot wait;
+    HistogramSnapshot run;
+};
+
+// what ThreadPool::stats() returns, a consistent-enough copy of everything
+struct PoolStats
+{
+    size_t workers = 0;     // live right now
+    size_t queueDepth = 0;  // queued right now, all queues
+    HistogramSnapshot wait; // ns
+    HistogramSnapshot run;  // ns
+    // busy fraction of each live worker since it started
+    std::vector<double> utilization;
+
+    uint64_t executed() const { return run.total; }
+
+    std::string toString() const
+    {
+        auto line = [](std::ostream& out, const char* name, const HistogramSnapshot& h)
+        {
+            out << name << "(us) mean:" << h.mean() / 1000.0
+                << " p50:" << h.percentile(50) / 1000.0
+                << " p90:" << h.percentile(90) / 1000.0
+                << " p99:" << h.percentile(99) / 1000.0
+                << " p99.9:" << h.percentile(99.9) / 1000.0
+                << " max:" << h.max / 1000.0 << "\n";
+        };
+
+        std::ostringstream out;
+        out << "workers:" << workers << " queued:" << queueDepth << " executed:" << executed() << "\n";
+        line(out, "wait", wait);
+        line(out, "run ", run);
+        out << "utilization:";
+        for (size_t i = 0; i < utilization.size(); i++)
+        {
+            out << " " << int(utilization[i] * 100 + 0.5) << "%";
+        }
+        out << "\n";
+        return out.str();
+    }
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "inline_task.h"
+#include "ring_buffer.h"
+
+enum class TaskPriority
+{
+    High,
+    Normal,
+    Low,
+};
+
+constexpr size_t NUM_TASK_PRIORITIES = 3;
+
+// queueing metrics for one priority lane
+struct LaneStats
+{
+    size_t queued = 0;         // waiting right now
+    size_t executed = 0;       // popped so far
+    size_t deadlineMisses = 0; // popped after their deadline had passed
+    std::chrono::nanoseconds totalWait{0};
+    std::chrono::nanoseconds maxWait{0};
+
+    std::chrono::nanoseconds averageWait() const
+    {
+        return executed ? totalWait / int64_t(executed) : std::chrono::nanoseconds(0);
+    }
+};
+
+/*
+ * The pool's shared queue: one lane per TaskPriority, served highest first.
+ * Inside a lane, tasks with a deadline go earliest-deadline-first (a heap)
+ * ahead of the plain FIFO tasks.
+ *
+ * Starvation protection: once the oldest task of a lane (or of the FIFO
+ * inside a lane) has waited longer than the starvation limit it is served
+ * next, regardless of priority or deadlines.
+ *
+ * Not thread safe, the pool calls it under its mutex.
+ */
+class PriorityTaskQueue
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    PriorityTaskQueue()
+    : starvationLimit_(std::chrono::milliseconds(50))
+    , size_(0)
+    {
+    }
+
+    void push(InlineTask task, TaskPriority priority, Clock::time_point now, Clock::time_point deadline = NO_DEADLINE)
+    {
+        Lane& lane = lanes_[size_t(priority)];
+        if (deadline == NO_DEADLINE)
+        {
+            lane.fifo.push(Entry{ std::move(task), now, deadline, 0 });
+        }
+        else
+        {
+            lane.deadlines.push_back(Entry{ std::move(task), now, deadline, lane.nextSeq++ });
+            std::push_heap(lane.deadlines.begin(), lane.deadlines.end(), laterDeadline);
+        }
+        lane.stats.queued++;
+        size_++;
+    }
+
+    // wait (if given) gets how long the task sat in the queue
+    bool pop(InlineTask& out, Clock::time_point now, std::chrono::nanoseconds* wait = nullptr)
+    {
+        if (size_ == 0) return false;
+
+        Lane* pick = nullptr;
+        Clock::time_point oldest = Clock::time_point::max();
+        for (Lane& lane : lanes_)
+        {
+            if (lane.empty()) continue;
+            if (!pick) pick = &lane;
+
+            Clock::time_point head = lane.oldest();
+            if (now - head > starvationLimit_ && head < oldest)
+            {
+                oldest = head;
+                pick = &lane;
+            }
+        }
+
+        Entry entry = pick->pop(now, starvationLimit_);
+        std::chrono::nanoseconds waited = now - entry.enqueued;
+        pick->stats.queued--;
+        pick->stats.executed++;
+        pick->stats.totalWait += waited;
+        pick->stats.maxWait = std::max(pick->stats.maxWait, waited);
+        if (wait) *wait = waited;
+        if (entry.deadline < now) pick->stats.deadlineMisses++;
+        size_--;
+
+        out = std::move(entry.task);
+        return true;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    // moves every queued task into out, so the caller can destroy them
+    // after letting go of its lock (stats of what already ran are kept)
+    void takeAll(std::vector<InlineTask>& out)
+    {
+        for (Lane& lane : lanes_)
+        {
+            while (!lane.fifo.empty())
+            {
+                out.push_back(std::move(lane.fifo.front().task));
+                lane.fifo.pop();
+            }
+            for (Entry& entry : lane.deadlines)
+            {
+                out.push_back(std::move(entry.task));
+            }
+            lane.deadlines.clear();
+            lane.stats.queued = 0;
+        }
+        size_ = 0;
+    }
+
+    // tasks that should jump ahead of a worker's local deque
+    size_t urgent() const
+    {
+        return lanes_[size_t(TaskPriority::High)].stats.queued + lanes_[size_t(TaskPriority::Normal)].deadlines.size()
+            + lanes_[size_t(TaskPriority::Low)].deadlines.size();
+    }
+
+    // enqueue time of the longest waiting task, max() if there is none
+    Clock::time_point oldest()
+    {
+        Clock::time_point t = Clock::time_point::max();
+        for (Lane& lane : lanes_)
+        {
+            if (!lane.empty()) t = std::min(t, lane.oldest());
+        }
+        return t;
+    }
+
+    void setStarvationLimit(Clock::duration limit) { starvationLimit_ = limit; }
+    Clock::duration starvationLimit() const { return starvationLimit_; }
+
+    LaneStats stats(TaskPriority priority) const { return lanes_[size_t(priority)].stats; }
+
+    static constexpr Clock::time_point NO_DEADLINE = Clock::time_point::max();
+
+private:
+    struct Entry
+    {
+        InlineTask task;
+        Clock::time_point enqueued;
+        Clock::time_point deadline;
+        uint64_t seq; // keeps equal deadlines FIFO
+    };
+
+    // std::push_heap builds a max-heap, so "less" means "runs later"
+    static bool laterDeadline(const Entry& a, const Entry& b)
+    {
+        if (a.deadline != b.deadline) return a.deadline > b.deadline;
+        return a.seq > b.seq;
+    }
+
+    struct Lane
+    {
+        bool empty() const { return fifo.empty() && deadlines.empty(); }
+
+        // enqueue time of the longest waiting task we can see cheaply (heap
+        // top is the earliest deadline, not necessarily the oldest entry)
+        Clock::time_point oldest()
+        {
+            Clock::time_point t = Clock::time_point::max();
+            if (!fifo.empty()) t = fifo.front().enqueued;
+            if (!deadlines.empty()) t = std::min(t, deadlines.front().enqueued);
+            return t;
+        }
+
+        Entry pop(Clock::time_point now, Clock::duration starvationLimit)
+        {
+            bool fifoStarving = !fifo.empty() && now - fifo.front().enqueued > starvationLimit;
+            if (!deadlines.empty() && !fifoStarving)
+            {
+                std::pop_heap(deadlines.begin(), deadlines.end(), laterDeadline);
+                Entry entry = std::move(deadlines.back());
+                deadlines.pop_back();
+                return entry;
+            }
+
+            Entry entry = std::move(fifo.front());
+            fifo.pop();
+            return entry;
+        }
+
+        RingBuffer<Entry> fifo;
+        std::vector<Entry> deadlines;
+        uint64_t nextSeq = 0;
+        LaneStats stats;
+    };
+
+    Lane lanes_[NUM_TASK_PRIORITIES];
+    Clock::duration starvationLimit_;
+    size_t size_;
+};
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "my_mutex.h"
+#include "queue_lock.h"
+
+/*
+ * Every thread takes the lock ITERATIONS times and bumps a shared counter,
+ * so almost all the time is lock handoff. Reports ns per acquisition for
+ * each lock and thread count (up to twice the core count, to show what
+ * oversubscription does), and checks that no increment got lost.
+ */
+
+#define ITERATIONS 20000
+
+template<typename Lock>
+void contend(const char* name, int numThreads)
+{
+    Lock lock;
+    long long counter = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < ITERATIONS; i++)
+            {
+                std::lock_guard<Lock> guard(lock);
+                counter++;
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+
+    long long expected = (long long)numThreads * ITERATIONS;
+    std::cout << std::boolalpha << name << " THREADS:" << numThreads
+              << " NS/LOCK:" << elapsed.count() / expected
+              << " " << (counter == expected) << std::endl;
+}
+
+int main()
+{
+    int maxThreads = 2 * std::max(1u, std::thread::hardware_concurrency());
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        contend<TtasLock<NoBackoff>>("TTAS           ", n);
+        contend<TtasLock<ExponentialBackoff>>("TTAS_EXP       ", n);
+        contend<TicketLock<ProportionalBackoff>>("TICKET_PROP    ", n);
+        contend<McsLock<ExponentialBackoff>>("MCS            ", n);
+        contend<ClhLock<ExponentialBackoff>>("CLH            ", n);
+        contend<Mutex>("MUTEX          ", n);
+    }
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "spin_wait.h"
+
+/*
+ * Spin locks where every waiter spins on its own cache line, so a handoff
+ * touches one waiter's line instead of invalidating the lock word in every
+ * waiting core (which is what makes a test-and-set lock fall over at high
+ * core counts). Both hand the lock over in FIFO order.
+ *
+ *   McsLock: waiters form a linked list, each spins on its own node and the
+ *            holder flips the successor's flag on unlock.
+ *   ClhLock: each waiter spins on its predecessor's node and takes it over
+ *            for its next acquisition.
+ *
+ * TicketLock is FIFO too but all waiters spin on the same counter; it is
+ * the one ProportionalBackoff is made for. TtasLock (test-and-test-and-set)
+ * is there as the baseline to compare against.
+ *
+ * The Backoff parameter decides what a waiter does between two looks at the
+ * flag. All policies start yielding the time slice after a while, so an
+ * oversubscribed machine (more waiters than cores) still makes progress.
+ *
+ * Like Mutex they are used through lock() / unlock() (and work with
+ * std::lock_guard). Queue nodes come from a per-thread cache, so a thread
+ * can hold any number of these locks at once. ClhLock has no try_lock():
+ * peeking at the tail node could touch a node that is being recycled.
+ */
+
+// pause and recheck, no backoff at all
+class NoBackoff
+{
+public:
+    void pause(size_t = 1)
+    {
+        if (++spins_ < YIELD_AFTER)
+        {
+            cpuRelax();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    static constexpr size_t YIELD_AFTER = 1 << 14;
+    size_t spins_ = 0;
+};
+
+// wait twice as long after every failed look, up to MAX_SPINS pauses
+class ExponentialBackoff
+{
+public:
+    void pause(size_t = 1)
+    {
+        if (limit_ >= MAX_SPINS)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        for (size_t i = 0; i < limit_; i++) cpuRelax();
+        limit_ *= 2;
+    }
+
+private:
+    static constexpr size_t MAX_SPINS = 1 << 10;
+    size_t limit_ = 1;
+};
+
+// wait in proportion to how far back in line we are (distance, as far as
+// the lock can tell), so the waiter that is up next checks most often
+class ProportionalBackoff
+{
+public:
+    void pause(size_t distance = 1)
+    {
+        size_t spins = distance * BASE_SPINS;
+        if (spins > YIELD_SPINS)
+        {
+            std::this_thread::yield();
+            return;
+        }
+        for (size_t i = 0; i < spins; i++) cpuRelax();
+    }
+
+private:
+    static constexpr size_t BASE_SPINS = 32;
+    static constexpr size_t YIELD_SPINS = 1 << 12;
+};
+
+struct alignas(64) QueueLockNode
+{
+    std::atomic<QueueLockNode*> next{ nullptr }; // MCS only
+    std::atomic<bool> locked{ false };
+};
+
+// per-thread spare nodes, freed when the thread exits
+class QueueLockNodeCache
+{
+public:
+    ~QueueLockNodeCache()
+    {
+        for (QueueLockNode* node : nodes_) delete node;
+    }
+
+    static QueueLockNode* get()
+    {
+        std::vector<QueueLockNode*>& nodes = local().nodes_;
+        if (nodes.empty()) return new QueueLockNode();
+        QueueLockNode* node = nodes.back();
+        nodes.pop_back();
+        return node;
+    }
+
+    static void put(QueueLockNode* node) { local().nodes_.push_back(node); }
+
+private:
+    static QueueLockNodeCache& local()
+    {
+        static thread_local QueueLockNodeCache cache;
+        return cache;
+    }
+
+    std::vector<QueueLockNode*> nodes_;
+};
+
+template<typename Backoff = ExponentialBackoff>
+class TtasLock
+{
+public:
+    TtasLock()
+    : locked_(false)
+    {
+    }
+    TtasLock(TtasLock&) = delete;
+    TtasLock(TtasLock&&) = delete;
+
+    void lock()
+    {
+        Backoff backoff;
+        for (;;)
+        {
+            if (!locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire)) return;
+            backoff.pause();
+        }
+    }
+
+    bool try_lock() { return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire); }
+
+    void unlock()
+    {
+        if (!locked_.exchange(false, std::memory_order_release))
+        {
+            throw std::runtime_error("TtasLock was not locked!");
+        }
+    }
+
+    bool getLocked() { return locked_.load(); }
+
+private:
+    std::atomic<bool> locked_;
+};
+
+template<typename Backoff = ProportionalBackoff>
+class TicketLock
+{
+public:
+    TicketLock()
+    : nextTicket_(0)
+    , nowServing_(0)
+    {
+    }
+    TicketLock(TicketLock&) = delete;
+    TicketLock(TicketLock&&) = delete;
+
+    void lock()
+    {
+        size_t ticket = nextTicket_.fetch_add(1, std::memory_order_relaxed);
+        Backoff backoff;
+        size_t serving;
+        while ((serving = nowServing_.load(std::memory_order_acquire)) != ticket)
+        {
+            backoff.pause(ticket - serving);
+        }
+    }
+
+    bool try_lock()
+    {
+        size_t ticket = nowServing_.load(std::memory_order_acquire);
+        return nextTicket_.compare_exchange_strong(ticket, ticket + 1, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        size_t serving = nowServing_.load(std::memory_order_relaxed);
+        if (serving == nextTicket_.load(std::memory_order_relaxed))
+        {
+            throw std::runtime_error("TicketLock was not locked!");
+        }
+        nowServing_.store(serving + 1, std::memory_order_release);
+    }
+
+    bool getLocked() { return nextTicket_.load() != nowServing_.load(); }
+
+private:
+    // on separate lines, arriving threads don't disturb the spinners
+    alignas(64) std::atomic<size_t> nextTicket_;
+    alignas(64) std::atomic<size_t> nowServing_;
+};
+
+template<typename Backoff = ExponentialBackoff>
+class McsLock
+{
+public:
+    McsLock()
+    : tail_(nullptr)
+    , holder_(nullptr)
+    {
+    }
+    McsLock(McsLock&) = delete;
+    McsLock(McsLock&&) = delete;
+
+    void lock()
+    {
+        QueueLockNode* me = QueueLockNodeCache::get();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        me->locked.store(true, std::memory_order_relaxed);
+
+        QueueLockNode* prev = tail_.exchange(me, std::memory_order_acq_rel);
+        if (prev)
+        {
+            prev->next.store(me, std::memory_order_release);
+            Backoff backoff;
+            while (me->locked.load(std::memory_order_acquire)) backoff.pause();
+        }
+        holder_ = me;
+    }
+
+    bool try_lock()
+    {
+        QueueLockNode* me = QueueLockNodeCache::get();
+        me->next.store(nullptr, std::memory_order_relaxed);
+
+        QueueLockNode* expected = nullptr;
+        if (!tail_.compare_exchange_strong(expected, me, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            QueueLockNodeCache::put(me);
+            return false;
+        }
+        holder_ = me;
+        return true;
+    }
+
+    void unlock()
+    {
+        QueueLockNode* me = holder_;
+        if (!me) throw std::runtime_error("McsLock was not locked!");
+        holder_ = nullptr;
+
+        QueueLockNode* next = me->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            // nobody behind us, unless someone swapped tail_ but hasn't
+            // linked itself in yet
+            QueueLockNode* expected = me;
+            if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+            {
+                QueueLockNodeCache::put(me);
+                return;
+            }
+            Backoff backoff;
+            while (!(next = me->next.load(std::memory_order_acquire))) backoff.pause();
+        }
+        next->locked.store(false, std::memory_order_release);
+        QueueLockNodeCache::put(me);
+    }
+
+    bool getLocked() { return tail_.load() != nullptr; }
+
+private:
+    std::atomic<QueueLockNode*> tail_;
+    // node of the current holder, only touched while holding the lock
+    QueueLockNode* holder_;
+};
+
+template<typename Backoff = ExponentialBackoff>
+class ClhLock
+{
+public:
+    ClhLock()
+    : tail_(new QueueLockNode())
+    , holder_(nullptr)
+    , holderPred_(nullptr)
+    {
+    }
+    ClhLock(ClhLock&) = delete;
+    ClhLock(ClhLock&&) = delete;
+
+    ~ClhLock()
+    {
+        // whichever node is last in line belongs to the lock
+        delete tail_.load();
+    }
+
+    void lock()
+    {
+        QueueLockNode* me = QueueLockNodeCache::get();
+        me->locked.store(true, std::memory_order_relaxed);
+
+        QueueLockNode* pred = tail_.exchange(me, std::memory_order_acq_rel);
+        Backoff backoff;
+        while (pred->locked.load(std::memory_order_acquire)) backoff.pause();
+        holder_ = me;
+        holderPred_ = pred;
+    }
+
+    void unlock()
+    {
+        QueueLockNode* me = holder_;
+        if (!me) throw std::runtime_error("ClhLock was not locked!");
+        QueueLockNode* pred = holderPred_;
+        holder_ = nullptr;
+        holderPred_ = nullptr;
+
+        // our successor spins on me from now on, pred is nobody's any more
+        me->locked.store(false, std::memory_order_release);
+        QueueLockNodeCache::put(pred);
+    }
+
+private:
+    std::atomic<QueueLockNode*> tail_;
+    // only touched while holding the lock
+    QueueLockNode* holder_;
+    QueueLockNode* holderPred_;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/*
+ * FIFO queue over a circular array with the same front()/pop()/push()
+ * interface as std::queue. Unlike std::deque (which allocates a new block
+ * every few hundred bytes) it only allocates when it has to grow, so once a
+ * queue has reached its working size pushes and pops are allocation free.
+ *
+ * Not thread safe, callers bring their own lock.
+ */
+template<typename T>
+class RingBuffer
+{
+public:
+    RingBuffer(size_t capacity = 64)
+    : items_(capacity > 0 ? capacity : 1)
+    , head_(0)
+    , size_(0)
+    {
+    }
+
+    void push(T item)
+    {
+        if (size_ == items_.size()) grow();
+        items_[(head_ + size_) % items_.size()] = std::move(item);
+        size_++;
+    }
+
+    T& front() { return items_[head_]; }
+
+    void pop()
+    {
+        // drop whatever the slot still holds (captures etc.) right away
+        items_[head_] = T();
+        head_ = (head_ + 1) % items_.size();
+        size_--;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+private:
+    void grow()
+    {
+        std::vector<T> bigger(items_.size() * 2);
+        for (size_t i = 0; i < size_; i++)
+        {
+            bigger[i] = std::move(items_[(head_ + i) % items_.size()]);
+        }
+        items_ = std::move(bigger);
+        head_ = 0;
+    }
+
+    std::vector<T> items_;
+    size_t head_;
+    size_t size_;
+};
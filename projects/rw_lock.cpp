@@ -0,0 +1,95 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "rw_lock.h"
+
+/*
+ * A small "routing table" read by every thread in a tight loop while one
+ * writer updates it every WRITE_INTERVAL. The table keeps first + second ==
+ * 0 as an invariant, so a reader that sees it broken has seen a torn write.
+ * Reports reads per second for std::shared_mutex, RwLock and SeqLockValue.
+ */
+
+#define RUN_TIME std::chrono::milliseconds(200)
+#define WRITE_INTERVAL std::chrono::microseconds(100)
+
+struct Route
+{
+    long long first;
+    long long second;
+};
+
+template<typename Read, typename Write>
+void readMostly(const char* name, int numReaders, Read read, Write write)
+{
+    std::atomic<bool> stop = false;
+    std::atomic<long long> reads = 0;
+    std::atomic<bool> torn = false;
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < numReaders; t++)
+    {
+        readers.emplace_back([&]()
+        {
+            long long n = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                Route route = read();
+                if (route.first + route.second != 0) torn = true;
+                n++;
+            }
+            reads += n;
+        });
+    }
+
+    std::thread writer([&]()
+    {
+        for (long long i = 1; !stop.load(); i++)
+        {
+            write(Route{ i, -i });
+            std::this_thread::sleep_for(WRITE_INTERVAL);
+        }
+    });
+
+    std::this_thread::sleep_for(RUN_TIME);
+    stop = true;
+    writer.join();
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+
+    double seconds = std::chrono::duration<double>(RUN_TIME).count();
+    std::cout << std::boolalpha << name << " READERS:" << numReaders
+              << " READS/S:" << size_t(reads / seconds)
+              << " CONSISTENT:" << !torn << std::endl;
+}
+
+int main()
+{
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        std::shared_mutex sharedMutex;
+        Route shared{ 0, 0 };
+        readMostly("SHARED_MUTEX", n,
+            [&]() { std::shared_lock<std::shared_mutex> lock(sharedMutex); return shared; },
+            [&](Route route) { std::lock_guard<std::shared_mutex> lock(sharedMutex); shared = route; });
+
+        RwLock rwLock;
+        Route guarded{ 0, 0 };
+        readMostly("RW_LOCK     ", n,
+            [&]() { std::shared_lock<RwLock> lock(rwLock); return guarded; },
+            [&](Route route) { std::lock_guard<RwLock> lock(rwLock); guarded = route; });
+
+        SeqLockValue<Route> seq(Route{ 0, 0 });
+        readMostly("SEQLOCK     ", n,
+            [&]() { return seq.load(); },
+            [&](Route route) { seq.store(route); });
+    }
+}
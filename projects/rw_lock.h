@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#include "futex.h"
+#include "my_mutex.h"
+#include "spin_wait.h"
+
+/*
+ * Reader-writer lock for read-mostly data.
+ *
+ * Readers only touch their own counter slot (one cache line per slot,
+ * about one slot per core), so concurrent readers never bounce a shared
+ * line between cores the way a single reader count does. The price is on
+ * the writer, which has to look at every slot.
+ *
+ * Writer preferring: once a writer has announced itself new readers wait,
+ * so a steady stream of readers can't starve it. Writers are serialized by
+ * a Mutex; readers that have to wait for a writer park on a futex, and
+ * mark it so the writer only makes the wake-up syscall if someone did.
+ *
+ * lock() / unlock() for writers and lock_shared() / unlock_shared() for
+ * readers, so it works with std::lock_guard, std::unique_lock and
+ * std::shared_lock. A read lock belongs to the calling thread's slot:
+ * unlock_shared() has to run on the thread that called lock_shared(), so
+ * a std::shared_lock must not be moved to another thread.
+ */
+class RwLock
+{
+public:
+    RwLock()
+    : numSlots_(slotCount())
+    , slots_(std::make_unique<Slot[]>(numSlots_))
+    , writer_(NO_WRITER)
+    {
+    }
+    RwLock(RwLock&) = delete;
+    RwLock(RwLock&&) = delete;
+
+    void lock_shared()
+    {
+        Slot& slot = mySlot();
+        for (;;)
+        {
+            // seq_cst increment then load, against the writer's seq_cst
+            // store then scan: either it sees our count or we see its flag
+            slot.readers.fetch_add(1);
+            if (writer_.load() == NO_WRITER) return;
+
+            // back off so the writer can finish, then try again
+            slot.readers.fetch_sub(1);
+            waitForWriter();
+        }
+    }
+
+    // same thread as the lock_shared(), the count is in its slot
+    void unlock_shared()
+    {
+        Slot& slot = mySlot();
+        if (slot.readers.fetch_sub(1, std::memory_order_release) <= 0)
+        {
+            // put it back, a count left at -1 would keep writers spinning
+            slot.readers.fetch_add(1, std::memory_order_relaxed);
+            throw std::runtime_error("RwLock was not read locked!");
+        }
+    }
+
+    void lock()
+    {
+        writers_.lock();
+        writer_.store(WRITER);
+
+        // seq_cst loads, an acquire load could be ordered before the store
+        // above and miss a reader that missed our flag
+        SpinWait spin;
+        for (size_t i = 0; i < numSlots_; i++)
+        {
+            while (slots_[i].readers.load() != 0)
+            {
+                if (spin.exhausted())
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    spin.spinOnce();
+                }
+            }
+        }
+    }
+
+    void unlock()
+    {
+        if (writer_.load(std::memory_order_relaxed) == NO_WRITER)
+        {
+            throw std::runtime_error("RwLock was not locked!");
+        }
+        if (writer_.exchange(NO_WRITER, std::memory_order_release) == WRITER_WITH_SLEEPERS)
+        {
+            futexWakeAll(writer_);
+        }
+        writers_.unlock();
+    }
+
+private:
+    static constexpr size_t MAX_SLOTS = 64;
+
+    // writer_ states
+    static constexpr uint32_t NO_WRITER = 0;
+    static constexpr uint32_t WRITER = 1;
+    static constexpr uint32_t WRITER_WITH_SLEEPERS = 2; // readers parked on writer_
+
+    struct alignas(64) Slot
+    {
+        std::atomic<int64_t> readers{ 0 };
+    };
+
+    static size_t slotCount()
+    {
+        size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        return std::min(MAX_SLOTS, cores);
+    }
+
+    // threads are dealt out round robin, a thread keeps its slot for life
+    Slot& mySlot()
+    {
+        static std::atomic<size_t> nextThread{ 0 };
+        static thread_local size_t threadIndex = nextThread.fetch_add(1, std::memory_order_relaxed);
+        return slots_[threadIndex % numSlots_];
+    }
+
+    void waitForWriter()
+    {
+        SpinWait spin;
+        while (!spin.exhausted())
+        {
+            if (writer_.load(std::memory_order_acquire) == NO_WRITER) return;
+            spin.spinOnce();
+        }
+
+        uint32_t state;
+        while ((state = writer_.load(std::memory_order_acquire)) != NO_WRITER)
+        {
+            // tell the writer to wake us; if it has just left (or a new
+            // one came in) look again
+            if (state == WRITER && !writer_.compare_exchange_strong(state, WRITER_WITH_SLEEPERS, std::memory_order_acquire))
+            {
+                continue;
+            }
+            futexWait(writer_, WRITER_WITH_SLEEPERS);
+        }
+    }
+
+    size_t numSlots_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<uint32_t> writer_;
+    Mutex writers_;
+};
+
+/*
+ * Sequence lock: writers bump a counter to odd before writing and back to
+ * even after, readers copy the data without taking any lock and retry if
+ * the counter was odd or moved while they were copying. Reads never make
+ * the writer wait and never write to shared memory, which makes it the
+ * fastest option for small, frequently read snapshots.
+ *
+ *   // writer                       // reader
+ *   seq.lock();                     uint32_t s;
+ *   x.store(1, relaxed);            do
+ *   y.store(2, relaxed);            {
+ *   seq.unlock();                       s = seq.readBegin();
+ *                                       a = x.load(relaxed); b = y.load(relaxed);
+ *                                   } while (seq.readRetry(s));
+ *
+ * The protected fields have to be atomics (relaxed is enough) since readers
+ * may look at them mid-write. SeqLockValue<T> below does that for any
+ * trivially copyable T.
+ */
+class SeqLock
+{
+public:
+    SeqLock()
+    : seq_(0)
+    {
+    }
+    SeqLock(SeqLock&) = delete;
+    SeqLock(SeqLock&&) = delete;
+
+    // writers exclude each other with a plain spin lock on the counter
+    void lock()
+    {
+        SpinWait spin;
+        for (;;)
+        {
+            uint32_t seq = seq_.load(std::memory_order_relaxed);
+            if (!(seq & 1) && seq_.compare_exchange_weak(seq, seq + 1, std::memory_order_relaxed))
+            {
+                // the odd count has to be visible before any of the writes
+                std::atomic_thread_fence(std::memory_order_release);
+                return;
+            }
+            spin.spinOnce();
+        }
+    }
+
+    void unlock()
+    {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        if (!(seq & 1))
+        {
+            throw std::runtime_error("SeqLock was not locked!");
+        }
+        seq_.store(seq + 1, std::memory_order_release);
+    }
+
+    // waits out a writer in progress
+    uint32_t readBegin() const
+    {
+        SpinWait spin;
+        uint32_t seq;
+        while ((seq = seq_.load(std::memory_order_acquire)) & 1)
+        {
+            spin.spinOnce();
+        }
+        return seq;
+    }
+
+    // true if what was read since readBegin() may be torn
+    bool readRetry(uint32_t seq) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq_.load(std::memory_order_relaxed) != seq;
+    }
+
+private:
+    std::atomic<uint32_t> seq_;
+};
+
+template<typename T>
+class SeqLockValue
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLockValue needs a trivially copyable type");
+
+public:
+    SeqLockValue(const T& value = T())
+    {
+        copyIn(value);
+    }
+
+    T load() const
+    {
+        uint64_t words[NUM_WORDS];
+        uint32_t seq;
+        do
+        {
+            seq = lock_.readBegin();
+            for (size_t i = 0; i < NUM_WORDS; i++)
+            {
+                words[i] = words_[i].load(std::memory_order_relaxed);
+            }
+        } while (lock_.readRetry(seq));
+
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+    void store(const T& value)
+    {
+        lock_.lock();
+        copyIn(value);
+        lock_.unlock();
+    }
+
+private:
+    static constexpr size_t NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    void copyIn(const T& value)
+    {
+        uint64_t words[NUM_WORDS] = {};
+        std::memcpy(words, &value, sizeof(T));
+        for (size_t i = 0; i < NUM_WORDS; i++)
+        {
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    SeqLock lock_;
+    std::atomic<uint64_t> words_[NUM_WORDS];
+};
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "sharded_counter.h"
+
+/*
+ * Checks that ShardedCounter loses no adds, also with more threads than
+ * slots (up to twice the core count), and what readApprox() caches. Its
+ * timings against the mutex.cpp strategies are the SHARDED_COUNTER case of
+ * lock_bench.cpp.
+ */
+
+#define ITERATIONS 200000
+
+bool countsAll(int numThreads)
+{
+    ShardedCounter counter;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < ITERATIONS; i++)
+            {
+                counter.add(1);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return counter.read() == (long long)numThreads * ITERATIONS;
+}
+
+int main()
+{
+    int maxThreads = 2 * std::max(1u, std::thread::hardware_concurrency());
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        std::cout << std::boolalpha << "SHARDED THREADS:" << n << " " << countsAll(n) << std::endl;
+    }
+
+    ShardedCounter polled;
+    polled.add(5);
+    int64_t first = polled.readApprox(std::chrono::seconds(1));
+    polled.add(5);
+    std::cout << "APPROX CACHED:" << (polled.readApprox(std::chrono::seconds(1)) == first)
+              << " FRESH:" << (polled.readApprox(std::chrono::nanoseconds(0)) == 10) << std::endl;
+}
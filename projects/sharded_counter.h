@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "cycle_clock.h"
+
+/*
+ * Counter for hot paths that many threads bump at once (stats, hit counts).
+ *
+ * A single std::atomic<int> makes every increment fight over one cache
+ * line; here each thread adds into its own slot (one cache line each, about
+ * one slot per core) and only read() looks at all of them. Threads are
+ * dealt out to slots round robin, like RwLock's reader slots, so with more
+ * threads than slots a few share one (still correct, the add is atomic).
+ *
+ * read() sums all slots: it sees every add that happened before it, and
+ * adds running concurrently may or may not be in. readApprox() is for
+ * frequent pollers: it hands out the last sum while that is younger than
+ * maxAge and only sums again after that.
+ */
+class ShardedCounter
+{
+public:
+    ShardedCounter()
+    : numSlots_(slotCount())
+    , slots_(std::make_unique<Slot[]>(numSlots_))
+    , cached_(0)
+    , cachedAt_(0)
+    {
+    }
+    ShardedCounter(ShardedCounter&) = delete;
+    ShardedCounter(ShardedCounter&&) = delete;
+
+    void add(int64_t delta)
+    {
+        slots_[threadIndex() % numSlots_].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void increment() { add(1); }
+
+    int64_t read() const
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < numSlots_; i++)
+        {
+            sum += slots_[i].value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    int64_t readApprox(std::chrono::nanoseconds maxAge) const
+    {
+        uint64_t now = CycleClock::now();
+        uint64_t at = cachedAt_.load(std::memory_order_acquire);
+        if (at != 0 && CycleClock::toNanos(now - at) < uint64_t(maxAge.count()))
+        {
+            return cached_.load(std::memory_order_relaxed);
+        }
+
+        int64_t sum = read();
+        cached_.store(sum, std::memory_order_relaxed);
+        cachedAt_.store(now, std::memory_order_release);
+        return sum;
+    }
+
+private:
+    static constexpr size_t MAX_SLOTS = 64;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<int64_t> value{ 0 };
+    };
+
+    static size_t slotCount()
+    {
+        size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        return std::min(MAX_SLOTS, cores);
+    }
+
+    // a thread keeps its index for life, shared by all counters
+    static size_t threadIndex()
+    {
+        static std::atomic<size_t> nextThread{ 0 };
+        static thread_local size_t index = nextThread.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    size_t numSlots_;
+    std::unique_ptr<Slot[]> slots_;
+    // readApprox() only, away from the slots
+    alignas(64) mutable std::atomic<int64_t> cached_;
+    mutable std::atomic<uint64_t> cachedAt_;
+};
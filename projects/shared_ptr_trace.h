@@ -0,0 +1,191 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+#include <typeinfo>
+
+#include "cycle_clock.h"
+
+/*
+ * Lifetime tracing for objects owned by MySharedPtr, picked at compile time
+ * with -DSHARED_PTR_TRACE=...
+ *
+ *   0 (default)  NoTrace, the hooks are empty inline functions
+ *   1            CountingTrace, how many were created / destroyed / alive
+ *   2            RingBufferTrace, the last RING_SIZE creations and
+ *                destructions with type, address, thread and time
+ *
+ * MySharedPtr calls SharedPtrTrace::created(object) and destroyed(object).
+ * Neither 1 nor 2 takes a lock or does any I/O on that path; both are read
+ * out on demand (dump()).
+ */
+
+#ifndef SHARED_PTR_TRACE
+#define SHARED_PTR_TRACE 0
+#endif
+
+struct NoTrace
+{
+    template<typename T>
+    static void created(const T*)
+    {
+    }
+
+    template<typename T>
+    static void destroyed(const T*)
+    {
+    }
+
+    static void dump(std::ostream&) {}
+};
+
+class CountingTrace
+{
+public:
+    template<typename T>
+    static void created(const T*)
+    {
+        counters().created.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template<typename T>
+    static void destroyed(const T*)
+    {
+        counters().destroyed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static size_t numCreated() { return counters().created.load(std::memory_order_relaxed); }
+    static size_t numDestroyed() { return counters().destroyed.load(std::memory_order_relaxed); }
+    static size_t numAlive() { return numCreated() - numDestroyed(); }
+
+    static void dump(std::ostream& out)
+    {
+        out << "SHARED OBJECTS created:" << numCreated() << " destroyed:" << numDestroyed()
+            << " alive:" << numAlive() << "\n";
+    }
+
+private:
+    struct Counters
+    {
+        alignas(64) std::atomic<size_t> created{ 0 };
+        alignas(64) std::atomic<size_t> destroyed{ 0 };
+    };
+
+    static Counters& counters()
+    {
+        static Counters counters;
+        return counters;
+    }
+};
+
+class RingBufferTrace
+{
+public:
+    static constexpr size_t RING_SIZE = 4096;
+
+    struct Event
+    {
+        uint64_t seq;
+        uint64_t ticks;
+        const void* object;
+        const char* type; // typeid(T).name()
+        bool created;
+        std::thread::id thread;
+    };
+
+    template<typename T>
+    static void created(const T* object)
+    {
+        record(object, typeid(T).name(), true);
+    }
+
+    template<typename T>
+    static void destroyed(const T* object)
+    {
+        record(object, typeid(T).name(), false);
+    }
+
+    // oldest first; entries being overwritten while we look are skipped
+    template<typename Fn>
+    static void forEach(Fn&& fn)
+    {
+        Ring& ring = instance();
+        uint64_t end = ring.next.load(std::memory_order_acquire);
+        uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+        for (uint64_t seq = begin; seq < end; seq++)
+        {
+            Slot& slot = ring.slots[seq % RING_SIZE];
+            // written under seq + 1 odd -> seq + 1 even, like a SeqLock
+            if (slot.version.load(std::memory_order_acquire) != 2 * (seq + 1)) continue;
+            Event event{ seq,
+                         slot.ticks.load(std::memory_order_relaxed),
+                         slot.object.load(std::memory_order_relaxed),
+                         slot.type.load(std::memory_order_relaxed),
+                         slot.created.load(std::memory_order_relaxed),
+                         slot.thread.load(std::memory_order_relaxed) };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.version.load(std::memory_order_relaxed) != 2 * (seq + 1)) continue;
+            fn(event);
+        }
+    }
+
+    static void dump(std::ostream& out)
+    {
+        forEach([&](const Event& event)
+        {
+            out << event.seq << (event.created ? " CREATED " : " DESTROYED ") << event.type << "@" << event.object
+                << " thread:" << event.thread << " ns:" << CycleClock::toNanos(event.ticks) << "\n";
+        });
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> version{ 0 };
+        std::atomic<uint64_t> ticks{ 0 };
+        std::atomic<const void*> object{ nullptr };
+        std::atomic<const char*> type{ nullptr };
+        std::atomic<bool> created{ false };
+        std::atomic<std::thread::id> thread;
+    };
+
+    struct Ring
+    {
+        std::atomic<uint64_t> next{ 0 };
+        std::array<Slot, RING_SIZE> slots;
+    };
+
+    static Ring& instance()
+    {
+        static Ring ring;
+        return ring;
+    }
+
+    static void record(const void* object, const char* type, bool created)
+    {
+        Ring& ring = instance();
+        uint64_t seq = ring.next.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = ring.slots[seq % RING_SIZE];
+
+        slot.version.store(2 * seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.ticks.store(CycleClock::now(), std::memory_order_relaxed);
+        slot.object.store(object, std::memory_order_relaxed);
+        slot.type.store(type, std::memory_order_relaxed);
+        slot.created.store(created, std::memory_order_relaxed);
+        slot.thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        slot.version.store(2 * (seq + 1), std::memory_order_release);
+    }
+};
+
+#if SHARED_PTR_TRACE == 2
+using SharedPtrTrace = RingBufferTrace;
+#elif SHARED_PTR_TRACE == 1
+using SharedPtrTrace = CountingTrace;
+#else
+using SharedPtrTrace = NoTrace;
+#endif
@@ -0,0 +1,84 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "slab_allocator.h"
+
+/*
+ * ns per allocate + free pair for global new / delete and SlabAllocator:
+ * LOCAL frees every block on the thread that allocated it, REMOTE hands
+ * each batch to another thread to free (the thread pool's submit / run
+ * pattern, which goes through the owner's remote free list).
+ */
+
+#define BATCH 10000
+#define ROUNDS 50
+#define OBJECT_SIZE 64
+
+struct Heap
+{
+    static void* allocate() { return ::operator new(OBJECT_SIZE); }
+    static void deallocate(void* p) { ::operator delete(p, OBJECT_SIZE); }
+};
+
+struct Slab
+{
+    static void* allocate() { return SlabAllocator::allocate(OBJECT_SIZE); }
+    static void deallocate(void* p) { SlabAllocator::deallocate(p, OBJECT_SIZE); }
+};
+
+template<typename Alloc>
+bool fill(std::vector<void*>& blocks)
+{
+    for (size_t i = 0; i < BATCH; i++)
+    {
+        blocks[i] = Alloc::allocate();
+        std::memset(blocks[i], int(i), OBJECT_SIZE);
+    }
+    // nothing handed out twice
+    bool ok = true;
+    for (size_t i = 0; i < BATCH; i++)
+    {
+        ok = ok && static_cast<unsigned char*>(blocks[i])[OBJECT_SIZE - 1] == (unsigned char)i;
+    }
+    return ok;
+}
+
+template<typename Alloc>
+void run(const char* name, bool remote)
+{
+    std::vector<void*> blocks(BATCH);
+    bool ok = true;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        ok = fill<Alloc>(blocks) && ok;
+        auto release = [&]()
+        {
+            for (void* block : blocks) Alloc::deallocate(block);
+        };
+        if (remote)
+        {
+            std::thread(release).join();
+        }
+        else
+        {
+            release();
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+
+    std::cout << std::boolalpha << name << (remote ? " REMOTE" : " LOCAL ")
+              << " NS/PAIR:" << elapsed.count() / (double(BATCH) * ROUNDS) << " " << ok << std::endl;
+}
+
+int main()
+{
+    run<Heap>("NEW_DELETE", false);
+    run<Slab>("SLAB      ", false);
+    run<Heap>("NEW_DELETE", true);
+    run<Slab>("SLAB      ", true);
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <utility>
+
+/*
+ * Allocator policies: static allocate(size, align) / deallocate(p, size,
+ * align), handed to the things that allocate on hot paths (MySharedPtr's
+ * control blocks, InlineTask's heap fallback, ThreadPool's task nodes) as a
+ * template parameter. Callers always pass the same size and alignment back
+ * to deallocate().
+ */
+
+// plain global operator new / delete
+struct HeapAllocator
+{
+    static void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) return ::operator new(size, std::align_val_t(align));
+        return ::operator new(size);
+    }
+
+    static void deallocate(void* p, size_t size, size_t align = alignof(std::max_align_t))
+    {
+        if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            ::operator delete(p, size, std::align_val_t(align));
+            return;
+        }
+        ::operator delete(p, size);
+    }
+};
+
+/*
+ * Thread-caching slab allocator for small objects (up to MAX_SIZE bytes,
+ * in size classes 16 bytes apart).
+ *
+ * Every thread has its own cache: a free list per size class, and slabs
+ * (SLAB_SIZE aligned chunks, each cut into blocks of one size class) it
+ * carves new blocks from. Allocating and freeing on the same thread is a
+ * pop / push on a thread-local list, no atomics at all.
+ *
+ * A block freed by another thread goes back to the cache that carved it,
+ * found through the header at the start of its slab, via that cache's
+ * remote free list (a lock-free stack). The owner takes the whole stack in
+ * one exchange when its own list for a size class runs dry. That is the
+ * producer / consumer case of a thread pool: the submitting thread
+ * allocates, a worker frees.
+ *
+ * Memory is never given back to the system. A cache outlives its thread and
+ * is handed, slabs and free lists and all, to the next thread that starts,
+ * so a pool that keeps replacing its workers doesn't keep growing.
+ *
+ * Bigger or over-aligned requests go to HeapAllocator.
+ */
+class SlabAllocator
+{
+public:
+    static constexpr size_t MAX_SIZE = 1024;
+    static constexpr size_t BLOCK_ALIGN = 16;
+
+    static void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        if (size > MAX_SIZE || align > BLOCK_ALIGN) return HeapAllocator::allocate(size, align);
+
+        size_t sizeClass = classOf(size);
+        if (ThreadCache* cache = localCache()) return cache->allocate(sizeClass);
+
+        // thread is past its thread_local destructors, share a cache
+        Registry& registry = Registry::instance();
+        std::lock_guard<std::mutex> lock(registry.orphanMtx);
+        return registry.orphan.allocate(sizeClass);
+    }
+
+    static void deallocate(void* p, size_t size, size_t align = alignof(std::max_align_t))
+    {
+        if (size > MAX_SIZE || align > BLOCK_ALIGN)
+        {
+            HeapAllocator::deallocate(p, size, align);
+            return;
+        }
+
+        SlabHeader* slab = slabOf(p);
+        if (slab->owner == tlsCache_)
+        {
+            slab->owner->push(slab->sizeClass, static_cast<FreeBlock*>(p));
+        }
+        else
+        {
+            slab->owner->pushRemote(static_cast<FreeBlock*>(p));
+        }
+    }
+
+    template<typename T, typename ...Args>
+    static T* create(Args&& ...args)
+    {
+        void* p = allocate(sizeof(T), alignof(T));
+        try
+        {
+            return new (p) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            deallocate(p, sizeof(T), alignof(T));
+            throw;
+        }
+    }
+
+    template<typename T>
+    static void destroy(T* object)
+    {
+        object->~T();
+        deallocate(object, sizeof(T), alignof(T));
+    }
+
+private:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t NUM_CLASSES = MAX_SIZE / BLOCK_ALIGN;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    class ThreadCache;
+
+    // first bytes of every slab, blocks start after it
+    struct alignas(64) SlabHeader
+    {
+        ThreadCache* owner;
+        size_t sizeClass;
+    };
+
+    class ThreadCache
+    {
+    public:
+        void* allocate(size_t sizeClass)
+        {
+            FreeBlock* block = free_[sizeClass];
+            if (!block && remote_.load(std::memory_order_relaxed))
+            {
+                drainRemote();
+                block = free_[sizeClass];
+            }
+            if (block)
+            {
+                free_[sizeClass] = block->next;
+                return block;
+            }
+            return carve(sizeClass);
+        }
+
+        void push(size_t sizeClass, FreeBlock* block)
+        {
+            block->next = free_[sizeClass];
+            free_[sizeClass] = block;
+        }
+
+        void pushRemote(FreeBlock* block)
+        {
+            FreeBlock* head = remote_.load(std::memory_order_relaxed);
+            do
+            {
+                block->next = head;
+            } while (!remote_.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        std::atomic<bool> owned{ false };
+        ThreadCache* next = nullptr; // in the registry
+
+    private:
+        void drainRemote()
+        {
+            // the whole stack at once, so no ABA on pop
+            FreeBlock* block = remote_.exchange(nullptr, std::memory_order_acquire);
+            while (block)
+            {
+                FreeBlock* next = block->next;
+                push(slabOf(block)->sizeClass, block);
+                block = next;
+            }
+        }
+
+        void* carve(size_t sizeClass)
+        {
+            size_t blockSize = (sizeClass + 1) * BLOCK_ALIGN;
+            if (size_t(bumpEnd_[sizeClass] - bump_[sizeClass]) < blockSize)
+            {
+                void* memory = std::aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+                if (!memory) throw std::bad_alloc();
+                new (memory) SlabHeader{ this, sizeClass };
+                bump_[sizeClass] = static_cast<char*>(memory) + sizeof(SlabHeader);
+                bumpEnd_[sizeClass] = static_cast<char*>(memory) + SLAB_SIZE;
+            }
+            void* block = bump_[sizeClass];
+            bump_[sizeClass] += blockSize;
+            return block;
+        }
+
+        // written by other threads, kept off the owner's lines
+        alignas(64) std::atomic<FreeBlock*> remote_{ nullptr };
+        alignas(64) FreeBlock* free_[NUM_CLASSES] = {};
+        char* bump_[NUM_CLASSES] = {};
+        char* bumpEnd_[NUM_CLASSES] = {};
+    };
+
+    // every cache ever made, they are never freed
+    struct Registry
+    {
+        static Registry& instance()
+        {
+            // leaked on purpose: blocks may be freed during static destruction
+            static Registry* registry = new Registry();
+            return *registry;
+        }
+
+        ThreadCache* adopt()
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (ThreadCache* cache = caches; cache; cache = cache->next)
+            {
+                if (!cache->owned.load(std::memory_order_relaxed))
+                {
+                    cache->owned.store(true, std::memory_order_relaxed);
+                    return cache;
+                }
+            }
+            ThreadCache* cache = new ThreadCache();
+            cache->owned.store(true, std::memory_order_relaxed);
+            cache->next = caches;
+            caches = cache;
+            return cache;
+        }
+
+        void disown(ThreadCache* cache)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cache->owned.store(false, std::memory_order_relaxed);
+        }
+
+        std::mutex mtx;
+        ThreadCache* caches = nullptr;
+
+        // for threads whose own cache is already gone
+        std::mutex orphanMtx;
+        ThreadCache orphan;
+    };
+
+    // gives the cache back when the thread exits
+    struct CacheOwner
+    {
+        ~CacheOwner()
+        {
+            if (tlsCache_) Registry::instance().disown(tlsCache_);
+            tlsCache_ = nullptr;
+            tlsExited_ = true;
+        }
+    };
+
+    static ThreadCache* localCache()
+    {
+        if (tlsCache_ || tlsExited_) return tlsCache_;
+
+        static thread_local CacheOwner owner;
+        (void)owner;
+        tlsCache_ = Registry::instance().adopt();
+        return tlsCache_;
+    }
+
+    static size_t classOf(size_t size) { return size ? (size - 1) / BLOCK_ALIGN : 0; }
+
+    static SlabHeader* slabOf(void* p)
+    {
+        return reinterpret_cast<SlabHeader*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(SLAB_SIZE - 1));
+    }
+
+    // plain pointers, so still usable while thread_local objects are being
+    // destroyed
+    static inline thread_local ThreadCache* tlsCache_ = nullptr;
+    static inline thread_local bool tlsExited_ = false;
+};
+
+// SlabAllocator as a standard allocator, for std::allocate_shared,
+// std::promise and containers
+template<typename T>
+struct SlabStdAllocator
+{
+    using value_type = T;
+
+    SlabStdAllocator() = default;
+
+    template<typename U>
+    SlabStdAllocator(const SlabStdAllocator<U>&)
+    {
+    }
+
+    T* allocate(size_t n) { return static_cast<T*>(SlabAllocator::allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T* p, size_t n) { SlabAllocator::deallocate(p, n * sizeof(T), alignof(T)); }
+
+    template<typename U>
+    bool operator==(const SlabStdAllocator<U>&) const { return true; }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <thread>
+
+// tell the cpu we are in a spin loop (saves power, and on hyperthreaded
+// cores lets the sibling thread run) without giving up the time slice
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// spin for a bit, then start yielding the time slice. Callers decide when
+// it is time to stop and block for real.
+class SpinWait
+{
+public:
+    static constexpr int SPIN_LIMIT = 64;
+    static constexpr int YIELD_LIMIT = 64 + 16;
+
+    void spinOnce()
+    {
+        if (count_ < SPIN_LIMIT)
+        {
+            cpuRelax();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+        count_++;
+    }
+
+    // true once both the spin and yield phases are used up
+    bool exhausted() const { return count_ >= YIELD_LIMIT; }
+
+    void reset() { count_ = 0; }
+
+private:
+    int count_ = 0;
+};
@@ -1,7 +1,9 @@
 #include <iostream>
+#include <latch>
 #include <vector>
 #include <string>
 
+#include "pool_future.h"
 #include "threadpool.h"
 
 using namespace std::chrono_literals;
@@ -33,7 +35,7 @@ int main()
     futures.push_back(pool.enqueue(add, 5, 6, 3));
     futuresS.push_back(pool.enqueue(sadd, "base", "ball", 4));
 
-    std::this_thread::sleep_for(5.5s);
+    // get() blocks until the result is ready, no need to sleep first
     for (auto& fut : futures)
     {
         std::cout << "RES MAIN THREAD:" << fut.get() << std::endl;
@@ -42,4 +44,68 @@ int main()
     {
         std::cout << "RES MAIN THREAD:" << fut.get() << std::endl;
     }
+
+    // chain follow-up work instead of blocking on get() in between
+    PoolFuture<int> a = poolAsync(pool, add, 1, 1, 1);
+    PoolFuture<int> b = poolAsync(pool, add, 2, 2, 0);
+    PoolFuture<int> sum = when_all(std::vector<PoolFuture<int>>{ a, b }).then([](const std::vector<int>& res)
+    {
+        return res[0] + res[1];
+    });
+    PoolFuture<std::string> msg = sum.then([](int res) { return "SUM:" + std::to_string(res); });
+    std::string res = msg.get();
+    std::cout << "RES WHEN_ALL:" << res << std::endl;
+
+    // load -> (parse, validate) -> store
+    TaskGraph graph;
+    TaskGraph::Node load = graph.addNode([]() { std::cout << "GRAPH: load" << std::endl; });
+    TaskGraph::Node parse = graph.addNode([]() { std::cout << "GRAPH: parse" << std::endl; });
+    TaskGraph::Node validate = graph.addNode([]() { std::cout << "GRAPH: validate" << std::endl; });
+    TaskGraph::Node store = graph.addNode([]() { std::cout << "GRAPH: store" << std::endl; });
+    graph.addEdge(load, parse);
+    graph.addEdge(load, validate);
+    graph.addEdge(parse, store);
+    graph.addEdge(validate, store);
+    graph.run(pool).get();
+
+    // shrink once the burst is over, then stop a long running task early
+    pool.resize(2);
+    std::latch ticking(1);
+    std::future<int> ticks = pool.enqueue([&ticking](std::stop_token stop)
+    {
+        int n = 0;
+        while (!stop.stop_requested())
+        {
+            std::this_thread::sleep_for(1ms);
+            if (n++ == 0) ticking.count_down();
+        }
+        return n;
+    });
+    // running for sure, so Discard stops it instead of dropping it
+    ticking.wait();
+    pool.shutdown(ThreadPool::ShutdownMode::Discard);
+    std::cout << std::boolalpha << "RES CANCELLED:" << (ticks.get() > 0) << std::endl;
+
+    // a continuation on a task that Discard drops: the dropped task breaks
+    // its promise and the continuation's future breaks along with it
+    ThreadPool single(1);
+    std::latch busy(1);
+    single.enqueue_detached([&busy]()
+    {
+        busy.count_down();
+        std::this_thread::sleep_for(50ms);
+    });
+    busy.wait();
+    PoolFuture<int> dropped = poolAsync(single, add, 1, 1, 0).then([](int res) { return res * 2; });
+    single.shutdown(ThreadPool::ShutdownMode::Discard);
+    bool broken = false;
+    try
+    {
+        dropped.get();
+    }
+    catch (const std::future_error& e)
+    {
+        broken = e.code() == std::future_errc::broken_promise;
+    }
+    std::cout << "RES DISCARDED CONTINUATION:" << broken << std::endl;
 }
\ No newline at end of file
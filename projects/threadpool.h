@@ -1,81 +1,1105 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <mutex>
-#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <stdexcept>
+#include <stop_token>
 #include <vector>
 #include <memory>
 #include <thread>
-#include <queue>
 #include <future>
 #include <iostream>
+#include <limits>
 #include <utility>
 #include <type_traits>
 
+#include "cpu_topology.h"
+#include "event_count.h"
+#include "inline_task.h"
+#include "mpmc_queue.h"
+#include "pool_stats.h"
+#include "priority_task_queue.h"
+#include "ring_buffer.h"
+#include "slab_allocator.h"
+#include "spin_wait.h"
+#include "timer_queue.h"
+#include "work_stealing_deque.h"
+
 class ThreadPool
 {
+    // what enqueue(func, args...) returns; funcs taking a std::stop_token
+    // first get the pool's token passed in
+    template<typename F, typename ...Args>
+    static constexpr bool takesStopToken = std::is_invocable_v<std::decay_t<F>&, std::stop_token, std::decay_t<Args>&...>;
+
+    template<typename F, typename ...Args>
+    using TaskResult = typename std::conditional_t<takesStopToken<F, Args...>,
+                                                   std::invoke_result<std::decay_t<F>&, std::stop_token, std::decay_t<Args>&...>,
+                                                   std::invoke_result<std::decay_t<F>&, std::decay_t<Args>&...>>::type;
+
+    // a task sitting in a deque, a node queue or the ring; queued is empty
+    // unless stats are compiled in
+    struct TaskNode
+    {
+        InlineTask task;
+        [[no_unique_address]] TaskStamp queued;
+    };
+
 public:
-    ThreadPool(int numThreads)
+    using Clock = std::chrono::steady_clock;
+    using Priority = TaskPriority;
+
+    static constexpr Clock::time_point NO_DEADLINE = PriorityTaskQueue::NO_DEADLINE;
+
+    enum class Mode
+    {
+        SharedQueue,   // every task goes through taskQueue_ under mtx_
+        WorkStealing,  // each worker owns a Chase-Lev deque, idle workers steal
+        LockFreeQueue, // plain tasks go through a bounded lock-free ring, the
+                       // rest (and overflow when it is full) through taskQueue_
+    };
+
+    // slots in the LockFreeQueue mode ring
+    static constexpr size_t RING_CAPACITY = 1024;
+
+    enum class ShutdownMode
+    {
+        Drain,   // run everything already queued (and whatever that spawns)
+        Discard, // drop queued tasks (their futures get broken_promise) and
+                 // request stop on the pool's stop_token
+    };
+
+    // what a worker does when it runs out of tasks
+    enum class IdlePolicy
+    {
+        SpinYieldPark, // spin, then yield, then block on wakeup_
+        Block,         // block on wakeup_ right away, cheapest on cpu
+        BusyPoll,      // never block, burns a core per worker for latency
+    };
+
+    // where workers may run. Worker i belongs to NUMA node i % numNodes(),
+    // whether pinned or not, which is what enqueue_on() goes by.
+    enum class Affinity
+    {
+        None, // let the OS schedule them
+        Core, // one cpu per worker, spread round robin over the nodes
+        Node, // any cpu of the worker's node
+    };
+
+    ThreadPool(int numThreads, Mode mode = Mode::SharedQueue, IdlePolicy idlePolicy = IdlePolicy::SpinYieldPark,
+               Affinity affinity = Affinity::None)
     : numThreads_(numThreads)
+    , targetThreads_(numThreads)
+    , minThreads_(0)
+    , maxThreads_(0)
+    , idleTimeout_(Clock::duration::zero())
     , quit_(false)
+    , discard_(false)
+    , mode_(mode)
+    , idlePolicy_(idlePolicy)
+    , affinity_(affinity)
+    , topology_(CpuTopology::detect())
+    , nodeQueues_(topology_.numNodes())
+    , nextWorkerId_(numThreads)
+    , pending_(0)
+    , urgent_(0)
+    , sharedNormal_(0)
+    , starvingAt_(NEVER)
     {
+        if (mode_ == Mode::WorkStealing)
+        {
+            for (size_t i = 0; i < numThreads_; i++)
+            {
+                localQueues_.emplace_back(std::make_unique<WorkStealingDeque<TaskNode*>>());
+            }
+        }
+        if (mode_ == Mode::LockFreeQueue) ring_ = std::make_unique<MpmcQueue<TaskNode>>(RING_CAPACITY);
+
         for (size_t i = 0; i < numThreads_; i++)
         {
-            workers_.emplace_back([&]()
+            WorkerStats* stats = newWorkerStats();
+            workers_.emplace_back([this, i, stats]() { workerLoop(i, stats); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        shutdown(ShutdownMode::Drain);
+    }
+
+    // a func whose first parameter is a std::stop_token gets the pool's
+    // token passed in (like std::jthread), see ShutdownMode::Discard
+    template<typename F, typename ...Args>
+    auto enqueue(F&& func, Args&& ...args) -> std::future<TaskResult<F, Args...>>
+    {
+        return enqueue(Priority::Normal, NO_DEADLINE, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    template<typename F, typename ...Args>
+    auto enqueue(Priority priority, F&& func, Args&& ...args) -> std::future<TaskResult<F, Args...>>
+    {
+        return enqueue(priority, NO_DEADLINE, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    // deadline tasks run earliest-deadline-first ahead of the plain tasks of
+    // the same priority. A missed deadline doesn't drop the task, it only
+    // shows up in laneStats().
+    template<typename F, typename ...Args>
+    auto enqueue(Priority priority, Clock::time_point deadline, F&& func, Args&& ...args) -> std::future<TaskResult<F, Args...>>
+    {
+        std::future<TaskResult<F, Args...>> fut;
+        submit(packageTask(fut, std::forward<F>(func), std::forward<Args>(args)...), priority, deadline);
+        return fut;
+    }
+
+    // fire and forget, no future and (for small closures) no allocation.
+    // An exception escaping func terminates the program, same as std::thread.
+    template<typename F, typename ...Args>
+    void enqueue_detached(F&& func, Args&& ...args)
+    {
+        enqueue_detached(Priority::Normal, NO_DEADLINE, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    template<typename F, typename ...Args>
+    void enqueue_detached(Priority priority, F&& func, Args&& ...args)
+    {
+        enqueue_detached(priority, NO_DEADLINE, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    template<typename F, typename ...Args>
+    void enqueue_detached(Priority priority, Clock::time_point deadline, F&& func, Args&& ...args)
+    {
+        submit(bindTask(std::forward<F>(func), std::forward<Args>(args)...), priority, deadline);
+    }
+
+    // like enqueue(), but preferably run by a worker of NUMA node `node`
+    // (e.g. the node that first touched the data). Other nodes' workers
+    // only take it when they have nothing else to do.
+    template<typename F, typename ...Args>
+    auto enqueue_on(size_t node, F&& func, Args&& ...args) -> std::future<TaskResult<F, Args...>>
+    {
+        std::future<TaskResult<F, Args...>> fut;
+        submitOn(node, packageTask(fut, std::forward<F>(func), std::forward<Args>(args)...));
+        return fut;
+    }
+
+    template<typename F, typename ...Args>
+    void enqueue_detached_on(size_t node, F&& func, Args&& ...args)
+    {
+        submitOn(node, bindTask(std::forward<F>(func), std::forward<Args>(args)...));
+    }
+
+    // whether enqueue() from the calling thread would still take a task:
+    // until shutdown(), and after that only from the pool's own tasks
+    bool accepting() const { return !quit_.load() || currentPool_ == this; }
+
+    size_t numNodes() const { return topology_.numNodes(); }
+
+    // node of the calling worker, 0 outside the pool
+    size_t currentNode() const { return currentPool_ == this ? nodeOf(currentWorker_) : 0; }
+
+    const CpuTopology& topology() const { return topology_; }
+
+    // snapshot of the counters, see pool_stats.h. Everything but workers
+    // and queueDepth stays empty unless built with THREADPOOL_STATS=1.
+    PoolStats stats()
+    {
+        PoolStats out;
+        out.workers = numThreads_.load();
+        out.queueDepth = pending_.load();
+        if constexpr (POOL_STATS_ENABLED)
+        {
+            std::lock_guard<std::mutex> lock(resizeMtx_);
+            uint64_t now = CycleClock::now();
+            if (retiredStats_)
+            {
+                out.wait.merge(retiredStats_->wait);
+                out.run.merge(retiredStats_->run);
+            }
+            for (const WorkerStats& worker : workerStats_)
             {
-                for (;;)
+                worker.wait.addTo(out.wait);
+                worker.run.addTo(out.run);
+                if (worker.retired.load()) continue;
+                uint64_t lifetime = std::max<uint64_t>(1, now - worker.started);
+                out.utilization.push_back(double(worker.busyTicks.load(std::memory_order_relaxed)) / double(lifetime));
+            }
+        }
+        return out;
+    }
+
+    // stops the pool and joins the workers. Enqueueing from outside the pool
+    // afterwards throws; tasks that are still running may keep enqueueing
+    // while draining. Must not be called from one of the pool's own tasks.
+    void shutdown(ShutdownMode mode = ShutdownMode::Drain)
+    {
+        if (currentPool_ == this) throw std::logic_error("ThreadPool::shutdown called from one of its own workers");
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            quit_.store(true);
+            if (mode == ShutdownMode::Discard) discard_.store(true);
+        }
+        if (mode == ShutdownMode::Discard) stopSource_.request_stop();
+        wakeup_.notifyAll();
+
+        // quit_ keeps new timers out; the pending ones can't be run by the
+        // pool any more, so they resume their coroutines here with the wait
+        // cancelled. Stopped outside timersMtx_: a coroutine the timer
+        // thread is resuming may try to add a timer.
+        std::unique_ptr<TimerQueue> timers;
+        {
+            std::lock_guard<std::mutex> lock(timersMtx_);
+            timers = std::move(timers_);
+        }
+        if (timers)
+        {
+            for (InlineTask& timer : timers->stop())
+            {
+                timer();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(resizeMtx_);
+        for (std::thread& worker : workers_)
+        {
+            worker.join();
+        }
+        workers_.clear();
+
+        // whatever is left never ran, destroying it breaks the promises.
+        // That runs their continuations, which may come back into the pool
+        // (and its mutex), so it all goes out first and dies unlocked.
+        std::vector<InlineTask> leftover;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            taskQueue_.takeAll(leftover);
+            for (RingBuffer<TaskNode>& queue : nodeQueues_)
+            {
+                while (!queue.empty())
                 {
-                    using namespace std::chrono_literals;
-                    
-                    std::unique_lock<std::mutex> lock(mtx_);
-                    cv_.wait(lock, [&]() { return !taskQueue_.empty() || quit_; });
-
-                    if (quit_) break;
-                    std::function<void()> task = taskQueue_.front();
-                    taskQueue_.pop();
-                    lock.unlock();
-                    task();
-                    std::this_thread::sleep_for(250ms);
+                    leftover.push_back(std::move(queue.front().task));
+                    queue.pop();
                 }
-            });
+            }
+            exited_.clear();
         }
+        for (auto& local : localQueues_)
+        {
+            while (std::optional<TaskNode*> task = local->pop())
+            {
+                leftover.push_back(std::move((*task)->task));
+                SlabAllocator::destroy(*task);
+            }
+        }
+        if (ring_)
+        {
+            TaskNode node;
+            while (ring_->tryPop(node))
+            {
+                leftover.push_back(std::move(node.task));
+            }
+        }
+        pending_.store(0);
+        leftover.clear();
     }
 
-    ~ThreadPool()
+    // token handed to tasks that take a std::stop_token, stop is requested
+    // by shutdown(ShutdownMode::Discard)
+    std::stop_token stopToken() const { return stopSource_.get_token(); }
+
+    // number of live workers
+    size_t numThreads() const { return numThreads_.load(); }
+
+    // grows right away, shrinks as soon as the extra workers finish their
+    // current task. Not in WorkStealing mode, the work-stealing deques are
+    // sized for the initial worker count.
+    void resize(size_t numThreads)
     {
-        mtx_.lock();
-        quit_ = true;
-        mtx_.unlock();
+        if (mode_ == Mode::WorkStealing) throw std::logic_error("ThreadPool::resize isn't supported in Mode::WorkStealing");
+        if (numThreads == 0) throw std::invalid_argument("ThreadPool needs at least one worker");
 
-        cv_.notify_all();
+        std::lock_guard<std::mutex> lock(resizeMtx_);
+        if (quit_.load()) throw std::runtime_error("ThreadPool is shut down");
 
-        for (size_t i = 0; i < numThreads_; i++)
+        joinExited();
+        targetThreads_.store(numThreads);
+        while (numThreads_.load() < numThreads)
         {
-            workers_[i].join();
+            spawnWorker();
         }
+
+        // idle workers have to wake up to notice they should retire
+        wakeup_.notifyAll();
     }
 
-    template<typename F, typename ...Args>
-    auto enqueue(F&& func, Args&& ...args) -> std::future<decltype(func(args...))>
+    // let the pool size itself between minThreads and maxThreads: a worker
+    // is added when more tasks are queued than there are workers, and one
+    // is retired each time a worker sat idle for idleTimeout.
+    // Not in WorkStealing mode, see resize().
+    void setAutoScale(size_t minThreads, size_t maxThreads, Clock::duration idleTimeout = std::chrono::seconds(1))
     {
-        using Task = std::packaged_task<decltype(func(args...))()>;
+        if (mode_ == Mode::WorkStealing) throw std::logic_error("ThreadPool::setAutoScale isn't supported in Mode::WorkStealing");
+        if (minThreads == 0 || minThreads > maxThreads) throw std::invalid_argument("ThreadPool autoscale needs 0 < minThreads <= maxThreads");
+
+        minThreads_.store(minThreads);
+        idleTimeout_.store(idleTimeout);
+        maxThreads_.store(maxThreads);
+    }
+
+    // queueing delay etc. of one priority lane of the shared queue (tasks
+    // that went through a worker's local deque aren't counted)
+    LaneStats laneStats(Priority priority)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return taskQueue_.stats(priority);
+    }
+
+    // a lane whose oldest task has waited this long gets served next, no
+    // matter what is queued in the higher lanes
+    void setStarvationLimit(Clock::duration limit)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        taskQueue_.setStarvationLimit(limit);
+        publishShared();
+    }
+
+    // submits every callable in tasks (they are moved out of the range)
+    // under one lock with a single wakeup, instead of a lock and a
+    // notify_one per task
+    template<typename Range>
+    void enqueue_bulk(Range&& tasks)
+    {
+        size_t count = 0;
+        if (mode_ == Mode::WorkStealing && currentPool_ == this)
+        {
+            for (auto& task : tasks)
+            {
+                localQueues_[currentWorker_]->push(allocNode(InlineTask(std::move(task))));
+                count++;
+            }
+            pending_.fetch_add(count);
+            wakeAfterLocalPush(count > 1);
+            return;
+        }
 
-        auto funcBind = std::bind(std::forward<F>(func), std::forward<Args>(args)...);
-        std::shared_ptr<Task> task = std::make_shared<Task>(funcBind);
-        std::future<decltype(func(args...))> fut = task->get_future();
-        auto task_wrapper = [task]() { (*task)(); };
+        Clock::time_point now = Clock::now();
         {
             std::lock_guard<std::mutex> lock(mtx_);
-            taskQueue_.push(task_wrapper);
+            checkAccepting();
+            for (auto& task : tasks)
+            {
+                taskQueue_.push(InlineTask(std::move(task)), Priority::Normal, now);
+                count++;
+            }
+            publishShared();
+            pending_.fetch_add(count);
         }
-        cv_.notify_one();
-        return fut;
+        wakeup_.notifyAll();
+    }
+
+    // runs fn(i) for every i in [begin, end), in chunks of grain indices
+    // (grain 0 picks a chunk size from the pool size). Blocks until all are
+    // done; the calling thread works on chunks too, so this is safe to call
+    // from inside a task. The first exception thrown by fn is rethrown here.
+    template<typename Index, typename F>
+    void parallel_for(Index begin, Index end, size_t grain, F&& fn)
+    {
+        size_t size = chunkSize(begin, end, grain);
+        forEachChunk(begin, end, size, numChunks(begin, end, size), [&](size_t, Index lo, Index hi)
+        {
+            for (Index i = lo; i < hi; i++)
+            {
+                fn(i);
+            }
+        });
     }
 
+    // reduce(reduce(identity, map(begin)), map(begin + 1))... computed per
+    // chunk in parallel, then the chunk results are combined in order so
+    // the result is deterministic for a given grain
+    template<typename Index, typename T, typename Map, typename Reduce>
+    T parallel_reduce(Index begin, Index end, size_t grain, T identity, Map&& map, Reduce&& reduce)
+    {
+        // sized once: with grain 0 a resize() in between would change the
+        // chunk count under us
+        size_t size = chunkSize(begin, end, grain);
+        size_t chunks = numChunks(begin, end, size);
+        std::vector<T> partials(chunks, identity);
+        forEachChunk(begin, end, size, chunks, [&](size_t chunk, Index lo, Index hi)
+        {
+            T acc = identity;
+            for (Index i = lo; i < hi; i++)
+            {
+                acc = reduce(std::move(acc), map(i));
+            }
+            partials[chunk] = std::move(acc);
+        });
+
+        T result = identity;
+        for (T& partial : partials)
+        {
+            result = reduce(std::move(result), std::move(partial));
+        }
+        return result;
+    }
+
+    // co_await pool.schedule() moves the coroutine onto one of the workers
+    struct ScheduleAwaiter
+    {
+        ThreadPool& pool;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { pool.enqueue_detached([handle]() { handle.resume(); }); }
+        void await_resume() const noexcept {}
+    };
+
+    // co_await pool.scheduleAfter(10ms) resumes on a worker once the delay
+    // has passed, without tying up a worker in the meantime. Throws if the
+    // pool is shut down, before or during the wait (broken_promise).
+    struct ScheduleAfterAwaiter
+    {
+        ThreadPool& pool;
+        TimerQueue::Clock::duration delay;
+        bool cancelled = false;
+
+        bool await_ready() const noexcept { return delay <= TimerQueue::Clock::duration::zero(); }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            pool.runTimer(delay, [this, handle]() { pool.resumeAfterTimer(*this, handle); });
+        }
+        void await_resume() const
+        {
+            if (cancelled) throw std::future_error(std::future_errc::broken_promise);
+        }
+    };
+
+    ScheduleAwaiter schedule() { return ScheduleAwaiter{ *this }; }
+    ScheduleAfterAwaiter scheduleAfter(TimerQueue::Clock::duration delay) { return ScheduleAfterAwaiter{ *this, delay }; }
+
 private:
-    size_t numThreads_;
-    bool quit_;
+    // closure that calls func(args...), with the stop token in front if func
+    // wants one (only then does it need to hold on to the pool)
+    template<typename F, typename ...Args>
+    auto bindTask(F&& func, Args&& ...args)
+    {
+        if constexpr (takesStopToken<F, Args...>)
+        {
+            return [this, func = std::forward<F>(func), ...args = std::forward<Args>(args)]() mutable -> decltype(auto)
+            {
+                return func(stopSource_.get_token(), args...);
+            };
+        }
+        else
+        {
+            return [func = std::forward<F>(func), ...args = std::forward<Args>(args)]() mutable -> decltype(auto)
+            {
+                return func(args...);
+            };
+        }
+    }
+
+    // what std::packaged_task does, but with the shared state (the only
+    // allocation, the closure fits in the InlineTask buffer) from the slab
+    // allocator, which packaged_task can't be given
+    template<typename F, typename ...Args>
+    auto packageTask(std::future<TaskResult<F, Args...>>& fut, F&& func, Args&& ...args)
+    {
+        using R = TaskResult<F, Args...>;
+
+        std::promise<R> promise(std::allocator_arg, SlabStdAllocator<R>());
+        fut = promise.get_future();
+        return [promise = std::move(promise), task = bindTask(std::forward<F>(func), std::forward<Args>(args)...)]() mutable
+        {
+            try
+            {
+                if constexpr (std::is_void_v<R>)
+                {
+                    task();
+                    promise.set_value();
+                }
+                else
+                {
+                    promise.set_value(task());
+                }
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+            }
+        };
+    }
+
+    // the timer thread is only started the first time someone needs it.
+    // Refused once shutdown has started.
+    void runTimer(TimerQueue::Clock::duration delay, InlineTask task)
+    {
+        std::lock_guard<std::mutex> lock(timersMtx_);
+        if (quit_.load()) throw std::runtime_error("ThreadPool is shut down");
+        if (!timers_) timers_ = std::make_unique<TimerQueue>();
+        timers_->runAfter(delay, std::move(task));
+    }
+
+    // on the timer thread, or in shutdown() for timers that never fired
+    void resumeAfterTimer(ScheduleAfterAwaiter& awaiter, std::coroutine_handle<> handle)
+    {
+        try
+        {
+            enqueue_detached([handle]() { handle.resume(); });
+            return;
+        }
+        catch (const std::runtime_error&)
+        {
+            // shut down; throwing here would take the timer thread down
+        }
+        awaiter.cancelled = true;
+        handle.resume();
+    }
+
+    template<typename Index>
+    size_t chunkSize(Index begin, Index end, size_t grain) const
+    {
+        if (grain > 0) return grain;
+        // a few chunks per worker so a slow chunk doesn't hold everyone up
+        size_t count = end > begin ? size_t(end - begin) : 0;
+        return std::max<size_t>(1, count / (numThreads_.load() * 4));
+    }
+
+    template<typename Index>
+    static size_t numChunks(Index begin, Index end, size_t size)
+    {
+        size_t count = end > begin ? size_t(end - begin) : 0;
+        return (count + size - 1) / size;
+    }
+
+    // hands out chunk indices from an atomic counter to up to numThreads_
+    // helper tasks plus the calling thread. size and chunks come from the
+    // caller, which may have sized its results by them.
+    template<typename Index, typename ChunkFn>
+    void forEachChunk(Index begin, Index end, size_t size, size_t chunks, ChunkFn&& chunkFn)
+    {
+        struct State
+        {
+            std::atomic<size_t> next = 0;
+            std::atomic<size_t> completed = 0;
+            std::atomic<bool> failed = false;
+            std::exception_ptr error;
+        };
+
+        if (chunks == 0) return;
+
+        // helpers may only get to run after we returned, so they share
+        // ownership of the bookkeeping; chunkFn itself is only touched while
+        // there are unclaimed chunks, i.e. before we return
+        std::shared_ptr<State> state = std::make_shared<State>();
+        auto work = [state, chunks, size, begin, end, fn = &chunkFn]()
+        {
+            for (size_t chunk = state->next.fetch_add(1); chunk < chunks; chunk = state->next.fetch_add(1))
+            {
+                Index lo = Index(begin + chunk * size);
+                Index hi = chunk == chunks - 1 ? end : Index(lo + size);
+                try
+                {
+                    (*fn)(chunk, lo, hi);
+                }
+                catch (...)
+                {
+                    if (!state->failed.exchange(true)) state->error = std::current_exception();
+                }
+                state->completed.fetch_add(1, std::memory_order_acq_rel);
+            }
+        };
+
+        size_t helpers = std::min(chunks - 1, numThreads_.load());
+        std::vector<InlineTask> tasks;
+        tasks.reserve(helpers);
+        for (size_t i = 0; i < helpers; i++)
+        {
+            tasks.emplace_back(work);
+        }
+        enqueue_bulk(tasks);
+
+        work();
+        SpinWait spin;
+        while (state->completed.load(std::memory_order_acquire) != chunks)
+        {
+            spin.spinOnce();
+        }
+
+        if (state->failed.load()) std::rethrow_exception(state->error);
+    }
+
+    void submit(InlineTask task, Priority priority = Priority::Normal, Clock::time_point deadline = NO_DEADLINE)
+    {
+        bool plain = priority == Priority::Normal && deadline == NO_DEADLINE;
+        if (mode_ == Mode::WorkStealing && currentPool_ == this && plain)
+        {
+            // submitted from one of our own workers, keep it local
+            localQueues_[currentWorker_]->push(allocNode(std::move(task)));
+            pending_.fetch_add(1);
+            wakeAfterLocalPush(false);
+            return;
+        }
+
+        // while plain tasks wait in taskQueue_ (ring overflow, bulk) new
+        // ones queue up behind them there, to stay in FIFO order
+        if (mode_ == Mode::LockFreeQueue && plain && !quit_.load() && sharedNormal_.load(std::memory_order_relaxed) == 0)
+        {
+            // counted first, so a worker never sees it popped before pushed
+            TaskNode node{ std::move(task), TaskStamp::now() };
+            size_t queued = pending_.fetch_add(1) + 1;
+            if (ring_->tryPush(std::move(node)))
+            {
+                wakeAfterLocalPush(false);
+                size_t live = numThreads_.load(std::memory_order_relaxed);
+                if (queued > live && live < maxThreads_.load(std::memory_order_relaxed)) autoGrow();
+                return;
+            }
+            // full, overflow into taskQueue_
+            pending_.fetch_sub(1);
+            task = std::move(node.task);
+        }
+
+        size_t queued;
+        Clock::time_point now = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            checkAccepting();
+            taskQueue_.push(std::move(task), priority, now, deadline);
+            publishShared();
+            queued = pending_.fetch_add(1) + 1;
+        }
+        // no syscall unless a worker is parked, spinning ones pick it up
+        // on their own
+        wakeup_.notify();
+
+        size_t live = numThreads_.load(std::memory_order_relaxed);
+        if (queued > live && live < maxThreads_.load(std::memory_order_relaxed)) autoGrow();
+    }
+
+    void submitOn(size_t node, InlineTask task)
+    {
+        if (node >= nodeQueues_.size()) throw std::out_of_range("ThreadPool::enqueue_on: no such NUMA node");
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            checkAccepting();
+            nodeQueues_[node].push(TaskNode{ std::move(task), TaskStamp::now() });
+            pending_.fetch_add(1);
+        }
+        // the sleeper we wake may be on another node; it runs the task
+        // anyway rather than leave it waiting
+        wakeup_.notify();
+    }
+
+    size_t nodeOf(size_t id) const { return id % nodeQueues_.size(); }
+
+    void pinWorker(size_t id)
+    {
+        if (affinity_ == Affinity::None) return;
+
+        const std::vector<int>& cpus = topology_.nodes[nodeOf(id)];
+        if (affinity_ == Affinity::Core)
+        {
+            pinCurrentThread(cpus[(id / nodeQueues_.size()) % cpus.size()]);
+        }
+        else
+        {
+            pinCurrentThread(cpus);
+        }
+    }
+
+    // mtx_ must be held. Only our own (still running) tasks may add work
+    // once shutdown has started.
+    void checkAccepting()
+    {
+        if (!accepting()) throw std::runtime_error("ThreadPool is shut down");
+    }
+
+    void autoGrow()
+    {
+        std::unique_lock<std::mutex> lock(resizeMtx_, std::try_to_lock);
+        if (!lock || quit_.load()) return;
+        joinExited();
+        if (numThreads_.load() >= maxThreads_.load()) return;
+        targetThreads_.store(std::max(targetThreads_.load(), numThreads_.load() + 1));
+        spawnWorker();
+    }
+
+    // resizeMtx_ must be held. Ids aren't reused, stats slots are.
+    void spawnWorker()
+    {
+        size_t id = nextWorkerId_++;
+        numThreads_.fetch_add(1);
+        WorkerStats* stats = newWorkerStats();
+        workers_.emplace_back([this, id, stats]() { workerLoop(id, stats); });
+    }
+
+    // resizeMtx_ must be held (or no worker started yet). A WorkerStats is
+    // two histograms of atomics, some 8 KB, so without stats there is none,
+    // and a retired worker's slot goes to the next one instead of piling up
+    // with resize() / autoscaling churn.
+    WorkerStats* newWorkerStats()
+    {
+        if constexpr (POOL_STATS_ENABLED)
+        {
+            for (WorkerStats& slot : workerStats_)
+            {
+                // retired is the worker's last write to its slot
+                if (!slot.retired.load()) continue;
+                if (!retiredStats_) retiredStats_ = std::make_unique<RetiredStats>();
+                slot.wait.addTo(retiredStats_->wait);
+                slot.run.addTo(retiredStats_->run);
+                slot.reuse();
+                return &slot;
+            }
+            return &workerStats_.emplace_back();
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+
+    // resizeMtx_ must be held, joins workers that retired
+    void joinExited()
+    {
+        std::vector<std::thread::id> exited;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            exited.swap(exited_);
+        }
+        for (std::thread::id id : exited)
+        {
+            auto it = std::find_if(workers_.begin(), workers_.end(), [id](std::thread& t) { return t.get_id() == id; });
+            it->join();
+            workers_.erase(it);
+        }
+    }
+
+    // claims one of the surplus worker slots after a shrink
+    bool shouldRetire()
+    {
+        size_t current = numThreads_.load(std::memory_order_relaxed);
+        while (current > targetThreads_.load(std::memory_order_relaxed))
+        {
+            if (numThreads_.compare_exchange_weak(current, current - 1)) return true;
+        }
+        return false;
+    }
+
+    // pending_ is already up, which a worker that is about to park
+    // rechecks after prepareWait(), so this can't get lost without mtx_
+    void wakeAfterLocalPush(bool all)
+    {
+        if (all)
+        {
+            wakeup_.notifyAll();
+        }
+        else
+        {
+            wakeup_.notify();
+        }
+    }
+
+    // stats lives in workerStats_, which never moves its elements, and is
+    // nullptr with stats compiled out
+    void workerLoop(size_t id, WorkerStats* stats)
+    {
+        currentPool_ = this;
+        currentWorker_ = id;
+        pinWorker(id);
+
+        InlineTask task;
+        uint64_t waitNs = 0;
+        bool retired = false;
+        for (;;)
+        {
+            if (discard_.load(std::memory_order_relaxed)) break;
+            if (shouldRetire())
+            {
+                retired = true;
+                break;
+            }
+
+            if (findTask(id, task, waitNs))
+            {
+                if constexpr (POOL_STATS_ENABLED)
+                {
+                    uint64_t start = CycleClock::now();
+                    task();
+                    stats->taskDone(waitNs, CycleClock::now() - start);
+                }
+                else
+                {
+                    task();
+                }
+                task.reset();
+                continue;
+            }
+
+            // draining: leave once nothing is queued anywhere. Work that
+            // the still running tasks spawn is picked up by their workers.
+            if (quit_.load() && pending_.load() == 0) break;
+            waitForWork();
+        }
+
+        if constexpr (POOL_STATS_ENABLED) stats->retired.store(true);
+        if (retired)
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            exited_.push_back(std::this_thread::get_id());
+        }
+        currentPool_ = nullptr;
+    }
+
+    bool shouldWake() const
+    {
+        return pending_.load() > 0
+            || quit_.load()
+            || numThreads_.load() > targetThreads_.load();
+    }
+
+    // returns once there may be work again (or we are quitting)
+    void waitForWork()
+    {
+        if (idlePolicy_ != IdlePolicy::Block)
+        {
+            SpinWait spin;
+            while (idlePolicy_ == IdlePolicy::BusyPoll || !spin.exhausted())
+            {
+                if (shouldWake()) return;
+                if (idlePolicy_ == IdlePolicy::BusyPoll)
+                {
+                    cpuRelax();
+                }
+                else
+                {
+                    spin.spinOnce();
+                }
+            }
+        }
+
+        // last look after registering: whatever is submitted from here on
+        // makes commitWait() return
+        EventCount::Key key = wakeup_.prepareWait();
+        if (shouldWake())
+        {
+            wakeup_.cancelWait();
+            return;
+        }
+
+        Clock::duration idleTimeout = idleTimeout_.load();
+        if (idleTimeout == Clock::duration::zero())
+        {
+            wakeup_.commitWait(key);
+        }
+        else if (!wakeup_.commitWaitFor(key, idleTimeout) && !shouldWake())
+        {
+            // idle for a whole timeout, give one worker back (not below
+            // minThreads_); the loop then retires whoever gets there first
+            size_t target = targetThreads_.load();
+            while (target > minThreads_.load() && !targetThreads_.compare_exchange_weak(target, target - 1)) {}
+        }
+    }
+
+    // waitNs gets how long the task was queued (stats builds only)
+    bool findTask(size_t id, InlineTask& out, uint64_t& waitNs)
+    {
+        if (mode_ == Mode::SharedQueue)
+        {
+            if (pending_.load(std::memory_order_relaxed) == 0) return false;
+            std::lock_guard<std::mutex> lock(mtx_);
+            return popShared(id, out, waitNs);
+        }
+
+        if (mode_ == Mode::LockFreeQueue)
+        {
+            if (pending_.load(std::memory_order_relaxed) == 0) return false;
+            // the ring only ever holds plain tasks: urgent ones go first, and
+            // so does a shared task that has waited past the starvation
+            // limit, or a busy ring would starve the Low lane for good
+            if (urgent_.load(std::memory_order_relaxed) == 0 && !sharedStarving())
+            {
+                TaskNode node;
+                if (ring_->tryPop(node)) return takeTask(node, out, waitNs);
+            }
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (popShared(id, out, waitNs)) return true;
+            TaskNode node;
+            return ring_->tryPop(node) && takeTask(node, out, waitNs);
+        }
+
+        // high priority / deadline tasks in the shared queue go before our
+        // own backlog
+        if (urgent_.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (popShared(id, out, waitNs)) return true;
+        }
+
+        // own deque first (LIFO, cache-hot), then the shared injection
+        // queue, then go steal from the other workers
+        if (std::optional<TaskNode*> task = localQueues_[id]->pop())
+        {
+            return takeTask(*task, out, waitNs);
+        }
+
+        if (mtx_.try_lock())
+        {
+            std::lock_guard<std::mutex> lock(mtx_, std::adopt_lock);
+            if (popShared(id, out, waitNs)) return true;
+        }
+
+        // steal from workers on our own node before crossing over
+        size_t numQueues = localQueues_.size();
+        for (int sameNode = 1; sameNode >= 0; sameNode--)
+        {
+            for (size_t i = 1; i < numQueues; i++)
+            {
+                size_t victim = (id + i) % numQueues;
+                if ((nodeOf(victim) == nodeOf(id)) != bool(sameNode)) continue;
+                if (std::optional<TaskNode*> task = localQueues_[victim]->steal())
+                {
+                    return takeTask(*task, out, waitNs);
+                }
+            }
+        }
+        return false;
+    }
+
+    // mtx_ must be held. Mirrors what findTask() looks at without the lock.
+    void publishShared()
+    {
+        urgent_.store(taskQueue_.urgent(), std::memory_order_relaxed);
+        if (mode_ != Mode::LockFreeQueue) return;
+
+        sharedNormal_.store(taskQueue_.stats(Priority::Normal).queued, std::memory_order_relaxed);
+        Clock::time_point oldest = taskQueue_.oldest();
+        Clock::duration limit = taskQueue_.starvationLimit();
+        bool never = oldest == Clock::time_point::max() || oldest > Clock::time_point::max() - limit;
+        starvingAt_.store(never ? NEVER : (oldest + limit).time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    bool sharedStarving() const
+    {
+        Clock::rep at = starvingAt_.load(std::memory_order_relaxed);
+        return at != NEVER && Clock::now().time_since_epoch().count() >= at;
+    }
+
+    // mtx_ must be held. Urgent shared tasks, then our node's queue, then
+    // the rest of the shared queue, then other nodes' leftovers.
+    bool popShared(size_t id, InlineTask& out, uint64_t& waitNs)
+    {
+        RingBuffer<TaskNode>& local = nodeQueues_[nodeOf(id)];
+        if (taskQueue_.urgent() == 0 && !local.empty())
+        {
+            return popNode(local, out, waitNs);
+        }
+        std::chrono::nanoseconds wait;
+        if (taskQueue_.pop(out, Clock::now(), &wait))
+        {
+            publishShared();
+            pending_.fetch_sub(1);
+            waitNs = uint64_t(wait.count());
+            return true;
+        }
+        for (RingBuffer<TaskNode>& queue : nodeQueues_)
+        {
+            if (!queue.empty()) return popNode(queue, out, waitNs);
+        }
+        return false;
+    }
+
+    // mtx_ must be held
+    bool popNode(RingBuffer<TaskNode>& queue, InlineTask& out, uint64_t& waitNs)
+    {
+        TaskNode& node = queue.front();
+        out = std::move(node.task);
+        if constexpr (POOL_STATS_ENABLED) waitNs = node.queued.nanosUntil(CycleClock::now());
+        queue.pop();
+        pending_.fetch_sub(1);
+        return true;
+    }
+
+    bool takeTask(TaskNode* node, InlineTask& out, uint64_t& waitNs)
+    {
+        takeTask(*node, out, waitNs);
+        SlabAllocator::destroy(node);
+        return true;
+    }
+
+    bool takeTask(TaskNode& node, InlineTask& out, uint64_t& waitNs)
+    {
+        out = std::move(node.task);
+        if constexpr (POOL_STATS_ENABLED) waitNs = node.queued.nanosUntil(CycleClock::now());
+        pending_.fetch_sub(1);
+        return true;
+    }
+
+    // deque slots have to be trivially copyable, so work-stealing tasks live
+    // in nodes from the slab allocator: a node run by the worker that pushed
+    // it goes straight back on that worker's free list, a stolen one is
+    // returned to it through the remote free list
+    TaskNode* allocNode(InlineTask&& task)
+    {
+        return SlabAllocator::create<TaskNode>(TaskNode{ std::move(task), TaskStamp::now() });
+    }
+
+    // live workers, and how many there should be (differ during a resize)
+    std::atomic<size_t> numThreads_;
+    std::atomic<size_t> targetThreads_;
+    // autoscaling, maxThreads_ == 0 means off
+    std::atomic<size_t> minThreads_;
+    std::atomic<size_t> maxThreads_;
+    std::atomic<Clock::duration> idleTimeout_;
+
+    std::atomic<bool> quit_;
+    std::atomic<bool> discard_;
+    std::stop_source stopSource_;
+    Mode mode_;
+    IdlePolicy idlePolicy_;
+    Affinity affinity_;
+    CpuTopology topology_;
     std::mutex mtx_;
-    std::condition_variable cv_;
+    // idle workers park here, see waitForWork()
+    EventCount wakeup_;
+    PriorityTaskQueue taskQueue_;
+    // enqueue_on() tasks, one FIFO per NUMA node, guarded by mtx_
+    std::vector<RingBuffer<TaskNode>> nodeQueues_;
+
+    // workers_, workerStats_, retiredStats_ and nextWorkerId_ are guarded
+    // by resizeMtx_, exited_ by mtx_
+    std::mutex resizeMtx_;
     std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> taskQueue_;
+    std::deque<WorkerStats> workerStats_;
+    std::unique_ptr<RetiredStats> retiredStats_;
+    size_t nextWorkerId_;
+    std::vector<std::thread::id> exited_;
+
+    // tasks queued anywhere
+    std::atomic<size_t> pending_;
+    // taskQueue_.urgent(), readable without the lock
+    std::atomic<size_t> urgent_;
+    // lock-free queue mode: Normal tasks in taskQueue_, and when its oldest
+    // task hits the starvation limit (NEVER if it's empty)
+    static constexpr Clock::rep NEVER = std::numeric_limits<Clock::rep>::max();
+    std::atomic<size_t> sharedNormal_;
+    std::atomic<Clock::rep> starvingAt_;
+
+    // work-stealing mode only
+    std::vector<std::unique_ptr<WorkStealingDeque<TaskNode*>>> localQueues_;
+    // lock-free queue mode only
+    std::unique_ptr<MpmcQueue<TaskNode>> ring_;
+
+    std::mutex timersMtx_;
+    std::unique_ptr<TimerQueue> timers_;
+
+    static inline thread_local ThreadPool* currentPool_ = nullptr;
+    static inline thread_local size_t currentWorker_ = 0;
 };
\ No newline at end of file
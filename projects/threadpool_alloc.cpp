@@ -0,0 +1,116 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include "threadpool.h"
+
+/*
+ * Counts every global operator new while tasks are submitted, to check that
+ * enqueue_detached() of a small closure doesn't allocate once the pool is
+ * warmed up (queues have reached their working size).
+ */
+
+#define NUM_TASKS 10000
+
+std::atomic<size_t> allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+std::atomic<size_t> done = 0;
+
+void work(int x, int y)
+{
+    done.fetch_add(x + y, std::memory_order_relaxed);
+}
+
+// spawns its children from inside a worker, exercising the local deques
+void spawn(ThreadPool& pool, int depth)
+{
+    done.fetch_add(1, std::memory_order_relaxed);
+    if (depth == 0) return;
+    pool.enqueue_detached(spawn, std::ref(pool), depth - 1);
+    pool.enqueue_detached(spawn, std::ref(pool), depth - 1);
+}
+
+void waitFor(size_t total)
+{
+    while (done.load() != total)
+    {
+        std::this_thread::yield();
+    }
+    done = 0;
+}
+
+size_t measureExternal(ThreadPool& pool)
+{
+    // warm up with every worker held, so the queue grows to the full
+    // NUM_TASKS however fast the workers would have drained it; the
+    // measured run never gets deeper than that
+    std::atomic<bool> gate = false;
+    std::atomic<size_t> held = 0;
+    size_t workers = pool.numThreads();
+    for (size_t i = 0; i < workers; i++)
+    {
+        pool.enqueue_detached([&]()
+        {
+            held++;
+            while (!gate.load()) std::this_thread::yield();
+        });
+    }
+    while (held.load() != workers) std::this_thread::yield();
+    for (int i = 0; i < NUM_TASKS; i++) pool.enqueue_detached(work, 1, 0);
+    gate = true;
+    waitFor(NUM_TASKS);
+
+    size_t before = allocations.load();
+    for (int i = 0; i < NUM_TASKS; i++) pool.enqueue_detached(work, 1, 0);
+    waitFor(NUM_TASKS);
+    return allocations.load() - before;
+}
+
+size_t measureNested(ThreadPool& pool)
+{
+    const int depth = 10;
+    const size_t total = (size_t(1) << (depth + 1)) - 1;
+
+    pool.enqueue_detached(spawn, std::ref(pool), depth);
+    waitFor(total);
+
+    size_t before = allocations.load();
+    pool.enqueue_detached(spawn, std::ref(pool), depth);
+    waitFor(total);
+    return allocations.load() - before;
+}
+
+int main()
+{
+    std::cout << std::boolalpha;
+    {
+        ThreadPool pool(4, ThreadPool::Mode::SharedQueue);
+        size_t allocs = measureExternal(pool);
+        std::cout << "SHARED_QUEUE ALLOCS:" << allocs << " " << (allocs == 0) << std::endl;
+    }
+    {
+        // a single worker, so every node is recycled by the worker that made it
+        ThreadPool pool(1, ThreadPool::Mode::WorkStealing);
+        size_t allocs = measureExternal(pool) + measureNested(pool);
+        std::cout << "WORK_STEALING ALLOCS:" << allocs << " " << (allocs == 0) << std::endl;
+    }
+    {
+        ThreadPool pool(4, ThreadPool::Mode::SharedQueue);
+        size_t before = allocations.load();
+        for (int i = 0; i < NUM_TASKS; i++) pool.enqueue(work, 1, 0);
+        waitFor(NUM_TASKS);
+        std::cout << "ENQUEUE ALLOCS PER TASK:" << double(allocations.load() - before) / NUM_TASKS << std::endl;
+    }
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "threadpool.h"
+
+/*
+ * Throughput of many tiny tasks. Every task fans out into two children until
+ * DEPTH is reached, so almost all submissions come from inside the workers,
+ * which is the case the work-stealing deques are built for.
+ *
+ * Data-parallel loop over PARALLEL_SIZE elements, one enqueue per element
+ * against enqueue_bulk() of the same tasks and against parallel_for().
+ *
+ * Lanes: a burst of low priority batch work with high priority requests
+ * trickling in behind it, reporting the queueing delay of each lane. Then
+ * the lock-free queue mode with its ring never running dry, where a Low
+ * task still has to get its turn once it hits the starvation limit.
+ *
+ * Built with -DTHREADPOOL_STATS=1 the lanes run also dumps pool.stats(),
+ * and comparing the fan-out numbers of both builds shows what the
+ * instrumentation costs per task.
+ *
+ * NUMA: every node gets its own slice of data, first touched by one of its
+ * workers, which then gets summed repeatedly either with enqueue_on() the
+ * owning node on a pinned pool or with plain enqueue() on an unpinned one.
+ *
+ * Latency is measured from enqueue() until the task starts running, one task
+ * in flight at a time, so it is mostly the cost of waking an idle worker.
+ */
+
+#define DEPTH 16
+#define PARALLEL_SIZE 1000000
+#define LATENCY_SAMPLES 5000
+#define NUMA_SLICE (1 << 22)
+#define NUMA_ROUNDS 20
+#define STARVATION_TIMEOUT std::chrono::seconds(2)
+
+using Clock = std::chrono::steady_clock;
+
+std::atomic<size_t> done = 0;
+
+void spawn(ThreadPool& pool, int depth)
+{
+    done.fetch_add(1, std::memory_order_relaxed);
+    if (depth == 0) return;
+    pool.enqueue(spawn, std::ref(pool), depth - 1);
+    pool.enqueue(spawn, std::ref(pool), depth - 1);
+}
+
+double throughput(int numThreads, ThreadPool::Mode mode)
+{
+    const size_t total = (size_t(1) << (DEPTH + 1)) - 1;
+    done = 0;
+
+    auto start = Clock::now();
+    {
+        ThreadPool pool(numThreads, mode);
+        pool.enqueue(spawn, std::ref(pool), DEPTH);
+        while (done.load() != total)
+        {
+            std::this_thread::yield();
+        }
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    return total / elapsed.count();
+}
+
+void latency(const char* name, ThreadPool::IdlePolicy policy)
+{
+    ThreadPool pool(2, ThreadPool::Mode::SharedQueue, policy);
+    std::vector<int64_t> samples;
+    samples.reserve(LATENCY_SAMPLES);
+
+    for (int i = 0; i < LATENCY_SAMPLES; i++)
+    {
+        auto submitted = Clock::now();
+        auto fut = pool.enqueue([submitted]()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - submitted).count();
+        });
+        samples.push_back(fut.get());
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << name
+              << " P50(ns):" << samples[samples.size() / 2]
+              << " P99(ns):" << samples[samples.size() * 99 / 100] << std::endl;
+}
+
+double elapsedSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void dataParallel(int numThreads)
+{
+    std::vector<int> data(PARALLEL_SIZE);
+    ThreadPool pool(numThreads);
+
+    done = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        pool.enqueue_detached([&data, i]() { data[i] = int(i) * 2; done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    while (done.load() != data.size()) std::this_thread::yield();
+    double perTask = elapsedSince(start);
+
+    done = 0;
+    start = Clock::now();
+    std::vector<InlineTask> tasks;
+    tasks.reserve(data.size());
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        tasks.emplace_back([&data, i]() { data[i] = int(i) * 2; done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    pool.enqueue_bulk(tasks);
+    while (done.load() != data.size()) std::this_thread::yield();
+    double bulk = elapsedSince(start);
+
+    start = Clock::now();
+    pool.parallel_for(size_t(0), data.size(), 0, [&data](size_t i) { data[i] = int(i) * 2; });
+    double parallelFor = elapsedSince(start);
+
+    std::cout << "THREADS:" << numThreads
+              << " PER_TASK(ms):" << perTask * 1000
+              << " BULK(ms):" << bulk * 1000
+              << " PARALLEL_FOR(ms):" << parallelFor * 1000 << std::endl;
+}
+
+void lanes()
+{
+    using namespace std::chrono_literals;
+
+    ThreadPool pool(2);
+    auto busyWork = []()
+    {
+        auto until = Clock::now() + 20us;
+        while (Clock::now() < until) {}
+    };
+
+    for (int i = 0; i < 5000; i++)
+    {
+        pool.enqueue_detached(ThreadPool::Priority::Low, busyWork);
+    }
+    std::vector<std::future<void>> requests;
+    for (int i = 0; i < 200; i++)
+    {
+        requests.push_back(pool.enqueue(ThreadPool::Priority::High, busyWork));
+        requests.push_back(pool.enqueue(ThreadPool::Priority::Normal, Clock::now() + 1ms, busyWork));
+        std::this_thread::sleep_for(100us);
+    }
+    for (auto& req : requests) req.get();
+    while (pool.laneStats(ThreadPool::Priority::Low).queued > 0) std::this_thread::sleep_for(1ms);
+
+    const char* names[] = { "HIGH  ", "NORMAL", "LOW   " };
+    for (size_t i = 0; i < NUM_TASK_PRIORITIES; i++)
+    {
+        LaneStats stats = pool.laneStats(ThreadPool::Priority(i));
+        std::cout << "LANE " << names[i]
+                  << " TASKS:" << stats.executed
+                  << " AVG_WAIT(us):" << stats.averageWait().count() / 1000
+                  << " MAX_WAIT(us):" << stats.maxWait.count() / 1000
+                  << " DEADLINE_MISSES:" << stats.deadlineMisses << std::endl;
+    }
+    if constexpr (POOL_STATS_ENABLED)
+    {
+        std::cout << pool.stats().toString();
+    }
+}
+
+// each plain task queues a copy of itself before it returns, so the ring
+// never runs dry, until the Low task has run (or STARVATION_TIMEOUT passed)
+struct Refill
+{
+    void operator()() const
+    {
+        auto until = Clock::now() + std::chrono::microseconds(2);
+        while (Clock::now() < until) {}
+        if (!lowRan->load() && Clock::now() < giveUp) pool->enqueue_detached(*this);
+    }
+
+    ThreadPool* pool;
+    std::atomic<bool>* lowRan;
+    Clock::time_point giveUp;
+};
+
+bool lowRunsPastFullRing()
+{
+    // outlives the pool, whose destructor still runs refills
+    std::atomic<bool> lowRan = false;
+    ThreadPool pool(1, ThreadPool::Mode::LockFreeQueue);
+    pool.setStarvationLimit(std::chrono::milliseconds(5));
+
+    Refill refill{ &pool, &lowRan, Clock::now() + STARVATION_TIMEOUT };
+    for (size_t i = 0; i < ThreadPool::RING_CAPACITY / 2; i++)
+    {
+        pool.enqueue_detached(refill);
+    }
+    pool.enqueue_detached(ThreadPool::Priority::Low, [&lowRan]() { lowRan = true; });
+
+    while (!lowRan.load() && Clock::now() < refill.giveUp)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return lowRan.load();
+}
+
+double numaSum(ThreadPool::Affinity affinity, bool local)
+{
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()), ThreadPool::Mode::SharedQueue,
+                    ThreadPool::IdlePolicy::SpinYieldPark, affinity);
+    size_t numNodes = pool.numNodes();
+
+    // first touch decides which node the pages end up on
+    std::vector<std::vector<int>> slices(numNodes);
+    std::vector<std::future<void>> touched;
+    for (size_t node = 0; node < numNodes; node++)
+    {
+        touched.push_back(pool.enqueue_on(node, [&slices, node]() { slices[node].assign(NUMA_SLICE, 1); }));
+    }
+    for (auto& fut : touched) fut.get();
+
+    auto start = Clock::now();
+    std::vector<std::future<long long>> sums;
+    for (int round = 0; round < NUMA_ROUNDS; round++)
+    {
+        for (size_t node = 0; node < numNodes; node++)
+        {
+            auto sum = [&slices, node]()
+            {
+                long long total = 0;
+                for (int x : slices[node]) total += x;
+                return total;
+            };
+            sums.push_back(local ? pool.enqueue_on(node, sum) : pool.enqueue(sum));
+        }
+    }
+    for (auto& fut : sums) fut.get();
+    return elapsedSince(start);
+}
+
+int main()
+{
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        std::cout << "THREADS:" << n
+                  << " SHARED_QUEUE TASKS/S:" << size_t(throughput(n, ThreadPool::Mode::SharedQueue))
+                  << " WORK_STEALING TASKS/S:" << size_t(throughput(n, ThreadPool::Mode::WorkStealing))
+                  << " LOCK_FREE_QUEUE TASKS/S:" << size_t(throughput(n, ThreadPool::Mode::LockFreeQueue)) << std::endl;
+    }
+
+    for (int n = 1; n <= maxThreads; n *= 2)
+    {
+        dataParallel(n);
+    }
+
+    lanes();
+    std::cout << std::boolalpha << "LOCK_FREE_QUEUE LOW RUNS PAST FULL RING:" << lowRunsPastFullRing() << std::endl;
+
+    std::cout << "NUMA_NODES:" << CpuTopology::detect().numNodes()
+              << " UNPINNED(ms):" << numaSum(ThreadPool::Affinity::None, false) * 1000
+              << " PINNED_LOCAL(ms):" << numaSum(ThreadPool::Affinity::Node, true) * 1000 << std::endl;
+
+    latency("SPIN_YIELD_PARK", ThreadPool::IdlePolicy::SpinYieldPark);
+    latency("BLOCK          ", ThreadPool::IdlePolicy::Block);
+    latency("BUSY_POLL      ", ThreadPool::IdlePolicy::BusyPoll);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "inline_task.h"
+
+/*
+ * One background thread that runs callbacks at (or shortly after) their
+ * deadline. Callbacks run on the timer thread itself, so they should only
+ * hand the real work off somewhere else (e.g. to a ThreadPool).
+ *
+ * stop() hands back the callbacks that haven't fired yet, the destructor
+ * drops them.
+ */
+class TimerQueue
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerQueue()
+    : quit_(false)
+    , thread_([this]() { run(); })
+    {
+    }
+    TimerQueue(TimerQueue&) = delete;
+    TimerQueue(TimerQueue&&) = delete;
+
+    ~TimerQueue()
+    {
+        stop();
+    }
+
+    // joins the thread (finishing a callback that's running) and returns
+    // the ones still pending, earliest first. No new ones after this.
+    std::vector<InlineTask> stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (quit_) return {};
+            quit_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+
+        std::vector<InlineTask> pending;
+        for (auto& [when, task] : timers_)
+        {
+            pending.push_back(std::move(task));
+        }
+        timers_.clear();
+        return pending;
+    }
+
+    void runAt(Clock::time_point when, InlineTask task)
+    {
+        bool earliest;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (quit_) throw std::runtime_error("TimerQueue is stopped");
+            auto it = timers_.emplace(when, std::move(task));
+            earliest = it == timers_.begin();
+        }
+        // only a new earliest deadline changes how long the thread sleeps
+        if (earliest) cv_.notify_one();
+    }
+
+    void runAfter(Clock::duration delay, InlineTask task)
+    {
+        runAt(Clock::now() + delay, std::move(task));
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (!quit_)
+        {
+            if (timers_.empty())
+            {
+                cv_.wait(lock);
+                continue;
+            }
+
+            auto first = timers_.begin();
+            if (first->first > Clock::now())
+            {
+                cv_.wait_until(lock, first->first);
+                continue;
+            }
+
+            InlineTask task = std::move(first->second);
+            timers_.erase(first);
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    bool quit_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    // multimap keeps timers with the same deadline in insertion order
+    std::multimap<Clock::time_point, InlineTask> timers_;
+    std::thread thread_;
+};
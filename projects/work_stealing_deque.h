@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Chase-Lev work-stealing deque (with the memory orderings from Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models").
+ *
+ * The owner thread push()es and pop()s at the bottom like a stack, any other
+ * thread can steal() from the top. Only the last element ever needs a CAS
+ * between owner and thieves, so the common push/pop path is just a couple of
+ * relaxed loads and stores.
+ *
+ * T has to be trivially copyable since slots are read while a thief may be
+ * racing with the owner (usually T is a pointer to the real task).
+ */
+template<typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable_v<T>, "WorkStealingDeque slots must be trivially copyable");
+
+    struct Buffer
+    {
+        Buffer(int64_t capacity)
+        : capacity_(capacity)
+        , mask_(capacity - 1)
+        , items_(new std::atomic<T>[capacity])
+        {
+        }
+
+        void put(int64_t i, T item) { items_[i & mask_].store(item, std::memory_order_relaxed); }
+        T get(int64_t i) const { return items_[i & mask_].load(std::memory_order_relaxed); }
+
+        Buffer* grow(int64_t bottom, int64_t top) const
+        {
+            Buffer* bigger = new Buffer(capacity_ * 2);
+            for (int64_t i = top; i != bottom; i++)
+            {
+                bigger->put(i, get(i));
+            }
+            return bigger;
+        }
+
+        int64_t capacity_;
+        int64_t mask_;
+        std::unique_ptr<std::atomic<T>[]> items_;
+    };
+
+public:
+    // capacity must be a power of two
+    WorkStealingDeque(int64_t capacity = 256)
+    : top_(0)
+    , bottom_(0)
+    , buffer_(new Buffer(capacity))
+    {
+        garbage_.emplace_back(buffer_.load(std::memory_order_relaxed));
+    }
+    WorkStealingDeque(WorkStealingDeque&) = delete;
+    WorkStealingDeque(WorkStealingDeque&&) = delete;
+
+    // owner only
+    void push(T item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Buffer* buf = buffer_.load(std::memory_order_relaxed);
+
+        if (b - t > buf->capacity_ - 1)
+        {
+            // thieves may still be reading the old buffer, so it is only
+            // freed together with the deque
+            buf = buf->grow(b, t);
+            garbage_.emplace_back(buf);
+            buffer_.store(buf, std::memory_order_release);
+        }
+
+        buf->put(b, item);
+        bottom_.store(b + 1, std::memory_order_release);
+    }
+
+    // owner only
+    std::optional<T> pop()
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Buffer* buf = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+
+        T item = buf->get(b);
+        if (t == b)
+        {
+            // last element, race the thieves for it
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            if (!won) return std::nullopt;
+        }
+        return item;
+    }
+
+    // any thread
+    std::optional<T> steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t >= b) return std::nullopt;
+
+        Buffer* buf = buffer_.load(std::memory_order_acquire);
+        T item = buf->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            // lost to the owner or another thief
+            return std::nullopt;
+        }
+        return item;
+    }
+
+    bool empty() const
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+    // top_ is hammered by thieves, bottom_ by the owner, keep them apart
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    alignas(64) std::atomic<Buffer*> buffer_;
+    std::vector<std::unique_ptr<Buffer>> garbage_;
+};